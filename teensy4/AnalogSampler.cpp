@@ -0,0 +1,110 @@
+/* Teensyduino Core Library
+ * http://www.pjrc.com/teensy/
+ * Copyright (c) 2017 PJRC.COM, LLC.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * 1. The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * 2. If the Software is incorporated into a build system that allows
+ * selection among a list of target devices, then similar target
+ * devices manufactured by PJRC.COM must be included in the list of
+ * target devices and selectable in the same manner.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "AnalogSampler.h"
+#include "imxrt.h"
+#include "core_pins.h"
+
+AnalogSampler * AnalogSampler::active = nullptr;
+
+// Each DMA minor loop copies one trigger's 4 results (2 words), into
+// either the first or second half of a frame.  The source address wraps
+// within those 8 bytes, and the minor loop offset skips over the other
+// ADC's half of the frame.
+static void config_results(DMAChannel &dma, volatile uint32_t *results,
+	uint16_t *dest, uint32_t frames)
+{
+	dma.TCD->SADDR = results;
+	dma.TCD->SOFF = 4;
+	dma.TCD->ATTR = DMA_TCD_ATTR_SSIZE(DMA_TCD_ATTR_SIZE_32BIT) |
+		DMA_TCD_ATTR_DSIZE(DMA_TCD_ATTR_SIZE_32BIT) | DMA_TCD_ATTR_SMOD(3);
+	dma.TCD->NBYTES_MLOFFYES = DMA_TCD_NBYTES_DMLOE |
+		DMA_TCD_NBYTES_MLOFFYES_MLOFF(8) | DMA_TCD_NBYTES_MLOFFYES_NBYTES(8);
+	dma.TCD->SLAST = 0;
+	dma.TCD->DADDR = dest;
+	dma.TCD->DOFF = 4;
+	dma.TCD->CITER = frames;
+	dma.TCD->DLASTSGA = -(int32_t)(frames * AnalogSampler::FRAME_SIZE * 2);
+	dma.TCD->BITER = frames;
+	dma.TCD->CSR = 0;
+}
+
+bool AnalogSampler::begin(const uint8_t *pins, uint8_t count, uint32_t rate,
+	uint16_t *buffer, uint32_t frames, callback_t callback)
+{
+	if (active || !buffer || !callback || !dma1.TCD || !dma2.TCD) return false;
+	if (frames < 2 || frames > 510 || (frames & 1)) return false;
+	this->buffer = buffer;
+	this->frames = frames;
+	this->callback = callback;
+	config_results(dma1, &IMXRT_ADC_ETC.TRIG[0].RESULT_1_0, buffer, frames);
+	config_results(dma2, &IMXRT_ADC_ETC.TRIG[4].RESULT_1_0, buffer + 4, frames);
+	// dma2 runs each time dma1 completes a frame, including the last
+	dma2.triggerAtTransfersOf(dma1);
+	dma2.triggerAtCompletionOf(dma1);
+	dma1.triggerAtHardwareEvent(DMAMUX_SOURCE_ADC_ETC);
+	dma2.attachInterrupt(isr);
+	dma2.interruptAtHalf();
+	dma2.interruptAtCompletion();
+	arm_dcache_delete(buffer, frames * FRAME_SIZE * 2);
+	active = this;
+	dma1.enable();
+	if (analog_continuous_begin(pins, count, rate, slots) < 0) {
+		dma1.disable();
+		active = nullptr;
+		return false;
+	}
+	return true;
+}
+
+void AnalogSampler::end()
+{
+	if (active != this) return;
+	analog_continuous_end();
+	dma1.disable();
+	dma2.disable();
+	dma2.clearInterrupt();
+	active = nullptr;
+}
+
+void AnalogSampler::isr(void)
+{
+	AnalogSampler *s = active;
+	if (!s) return;
+	s->dma2.clearInterrupt();
+	// CITER counts down from frames.  After the half interrupt it is at
+	// or below frames/2, and after completion it has reloaded to frames.
+	uint32_t half = s->frames / 2;
+	uint16_t *p = s->buffer;
+	if (s->dma2.TCD->CITER > half) p += half * FRAME_SIZE;
+	arm_dcache_delete(p, half * FRAME_SIZE * 2);
+	s->callback(p, half);
+	asm("dsb");
+}
@@ -0,0 +1,88 @@
+/* Teensyduino Core Library
+ * http://www.pjrc.com/teensy/
+ * Copyright (c) 2017 PJRC.COM, LLC.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * 1. The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * 2. If the Software is incorporated into a build system that allows
+ * selection among a list of target devices, then similar target
+ * devices manufactured by PJRC.COM must be included in the list of
+ * target devices and selectable in the same manner.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef __cplusplus
+#ifndef AnalogSampler_h_
+#define AnalogSampler_h_
+
+#include <stdint.h>
+#include "DMAChannel.h"
+
+extern "C" {
+int analog_continuous_begin(const uint8_t *pins, uint32_t count, uint32_t rate, uint8_t *slot);
+void analog_continuous_end(void);
+}
+
+// AnalogSampler reads up to 8 analog pins at a steady rate, using both
+// ADCs, a PIT timer and 2 DMA channels, without any CPU time per sample.
+// Up to 4 pins may be read by each ADC.  Results are stored in a ring
+// buffer of frames, each frame holding 8 samples (ADC1 in positions 0-3,
+// ADC2 in 4-7).  Use slot() to learn which position holds each pin.
+// The callback function is called from an interrupt each time half of
+// the buffer has been filled, while DMA writes the other half.  It may
+// trigger an EventResponder if the work should be done outside the
+// interrupt.  Only one AnalogSampler may run at a time, and analogRead()
+// returns 0 while it runs.
+class AnalogSampler {
+public:
+	typedef void (*callback_t)(const uint16_t *samples, uint32_t frames);
+	static const uint32_t FRAME_SIZE = 8;
+	AnalogSampler() {
+	}
+	~AnalogSampler() {
+		end();
+	}
+	// Begin sampling pins, rate times per second (up to 24000000, though
+	// the ADCs can't keep up with that).  The buffer must hold
+	// frames * FRAME_SIZE samples and should be 32 byte aligned, with
+	// frames an even number up to 510.  Returns true if successful, or
+	// false if the pins, ADCs, PIT timers or DMA channels are unavailable.
+	// The 2 DMA channels are allocated when AnalogSampler is created.
+	bool begin(const uint8_t *pins, uint8_t count, uint32_t rate,
+		uint16_t *buffer, uint32_t frames, callback_t callback);
+	// Stop sampling, giving the ADCs back to analogRead().
+	void end();
+	// Position of pins[index] within each frame.
+	uint8_t slot(uint8_t index) {
+		return (index < 8) ? slots[index] : 0;
+	}
+private:
+	static void isr(void);
+	static AnalogSampler *active;
+	DMAChannel dma1; // ADC1 results, triggered by ADC_ETC
+	DMAChannel dma2; // ADC2 results, linked from dma1
+	uint16_t *buffer = nullptr;
+	uint32_t frames = 0;
+	callback_t callback = nullptr;
+	uint8_t slots[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+};
+
+#endif // AnalogSampler_h_
+#endif // __cplusplus
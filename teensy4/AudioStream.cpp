@@ -29,50 +29,81 @@
  */
 
 
-#include <Arduino.h>
+#if defined(AUDIO_HOST_SIMULATION)
+#include <stdint.h>
+#include <time.h>
 #include "AudioStream.h"
 
-#if defined(__IMXRT1062__)
-  #define MAX_AUDIO_MEMORY 229376
-#endif
+// Stand-ins for the hardware used by the audio update scheduling
+// (__disable_irq() and __enable_irq() are in AudioStream.h)
+#define AUDIO_CYCLE_COUNT() audio_host_nanoseconds()
 
-#define NUM_MASKS  (((MAX_AUDIO_MEMORY / AUDIO_BLOCK_SAMPLES / 2) + 31) / 32)
+static inline uint32_t audio_host_nanoseconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)ts.tv_sec * 1000000000u + (uint32_t)ts.tv_nsec;
+}
+#else
+#include <Arduino.h>
+#include "AudioStream.h"
 
-audio_block_t * AudioStream::memory_pool;
-uint32_t AudioStream::memory_pool_available_mask[NUM_MASKS];
-uint16_t AudioStream::memory_pool_first_mask;
+#define AUDIO_CYCLE_COUNT() ARM_DWT_CYCCNT
+#endif
 
 uint16_t AudioStream::cpu_cycles_total = 0;
 uint16_t AudioStream::cpu_cycles_total_max = 0;
 uint16_t AudioStream::memory_used = 0;
 uint16_t AudioStream::memory_used_max = 0;
+audio_memory_pool_t AudioStream::memory_pools[AUDIO_MEMORY_POOLS];
+uint16_t AudioStream::feedback_loops = 0;
 AudioConnection* AudioStream::unused = NULL; // linked list of unused but not destructed connections
 
 void software_isr(void);
 
 
-// Set up the pool of audio data blocks
-// placing them all onto the free list
-FLASHMEM void AudioStream::initialize_memory(audio_block_t *data, unsigned int num)
+// Unused blocks are kept on a linked list per pool, with the
+// next pointer stored in the block's data.
+static inline audio_block_t * next_free(const audio_block_t *block)
+{
+	audio_block_t *next;
+	memcpy(&next, block->data, sizeof(next));
+	return next;
+}
+
+static inline void set_next_free(audio_block_t *block, audio_block_t *next)
+{
+	memcpy(block->data, &next, sizeof(next));
+}
+
+// Set up a pool of audio data blocks
+// placing them all onto its free list
+FLASHMEM void AudioStream::initialize_memory(audio_block_t *data, unsigned int num, unsigned int pool)
 {
 	unsigned int i;
-	unsigned int maxnum = MAX_AUDIO_MEMORY / AUDIO_BLOCK_SAMPLES / 2;
+	audio_memory_pool_t *mp;
 
 	//Serial.println("AudioStream initialize_memory");
 	//delay(10);
-	if (num > maxnum) num = maxnum;
+	if (pool >= AUDIO_MEMORY_POOLS) return;
+	if (num > 65535) num = 65535;
+	mp = &memory_pools[pool];
 	__disable_irq();
-	memory_pool = data;
-	memory_pool_first_mask = 0;
-	for (i=0; i < NUM_MASKS; i++) {
-		memory_pool_available_mask[i] = 0;
-	}
-	for (i=0; i < num; i++) {
-		memory_pool_available_mask[i >> 5] |= (1 << (i & 0x1F));
-	}
 	for (i=0; i < num; i++) {
+		data[i].memory_pool_number = pool;
 		data[i].memory_pool_index = i;
+		set_next_free(&data[i], (i + 1 < num) ? &data[i + 1] : NULL);
 	}
+	mp->free_list = (num > 0) ? data : NULL;
+	mp->num = num;
+	// blocks the old pool had in use are gone from the total too
+	memory_used -= mp->used;
+	mp->used = 0;
+	mp->used_max = 0;
+#if defined(AUDIO_HOST_SIMULATION)
+	// updates are driven only by simulate()
+	update_setup();
+#else
 	if (update_scheduled == false) {
 		// if no hardware I/O has taken responsibility for update,
 		// start a timer which will call update_all() at the correct rate
@@ -83,44 +114,39 @@ FLASHMEM void AudioStream::initialize_memory(audio_block_t *data, unsigned int n
 			update_setup();
 		}
 	}
+#endif
 	__enable_irq();
 }
 
 // Allocate 1 audio data block.  If successful
-// the caller is the only owner of this new block
-audio_block_t * AudioStream::allocate(void)
+// the caller is the only owner of this new block.
+// If the requested pool is empty, the general pool is used.
+audio_block_t * AudioStream::allocate(unsigned int pool)
 {
-	uint32_t n, index, avail;
-	uint32_t *p, *end;
+	audio_memory_pool_t *mp;
 	audio_block_t *block;
 	uint32_t used;
 
-	p = memory_pool_available_mask;
-	end = p + NUM_MASKS;
+	if (pool >= AUDIO_MEMORY_POOLS) pool = AUDIO_MEMORY_GENERAL;
+	mp = &memory_pools[pool];
 	__disable_irq();
-	index = memory_pool_first_mask;
-	p += index;
-	while (1) {
-		if (p >= end) {
-			__enable_irq();
-			//Serial.println("alloc:null");
-			return NULL;
-		}
-		avail = *p;
-		if (avail) break;
-		index++;
-		p++;
+	block = mp->free_list;
+	if (block == NULL && pool != AUDIO_MEMORY_GENERAL) {
+		mp = &memory_pools[AUDIO_MEMORY_GENERAL];
+		block = mp->free_list;
 	}
-	n = __builtin_clz(avail);
-	avail &= ~(0x80000000 >> n);
-	*p = avail;
-	if (!avail) index++;
-	memory_pool_first_mask = index;
+	if (block == NULL) {
+		__enable_irq();
+		//Serial.println("alloc:null");
+		return NULL;
+	}
+	mp->free_list = next_free(block);
+	used = mp->used + 1;
+	mp->used = used;
+	if (used > mp->used_max) mp->used_max = used;
 	used = memory_used + 1;
 	memory_used = used;
 	__enable_irq();
-	index = p - memory_pool_available_mask;
-	block = memory_pool + ((index << 5) + (31 - n));
 	block->ref_count = 1;
 	if (used > memory_used_max) memory_used_max = used;
 	//Serial.print("alloc:");
@@ -130,12 +156,11 @@ audio_block_t * AudioStream::allocate(void)
 
 // Release ownership of a data block.  If no
 // other streams have ownership, the block is
-// returned to the free pool
+// returned to the free list of its pool
 void AudioStream::release(audio_block_t *block)
 {
 	//if (block == NULL) return;
-	uint32_t mask = (0x80000000 >> (31 - (block->memory_pool_index & 0x1F)));
-	uint32_t index = block->memory_pool_index >> 5;
+	audio_memory_pool_t *mp = &memory_pools[block->memory_pool_number];
 
 	__disable_irq();
 	if (block->ref_count > 1) {
@@ -143,8 +168,9 @@ void AudioStream::release(audio_block_t *block)
 	} else {
 		//Serial.print("reles:");
 		//Serial.println((uint32_t)block, HEX);
-		memory_pool_available_mask[index] |= mask;
-		if (index < memory_pool_first_mask) memory_pool_first_mask = index;
+		set_next_free(block, mp->free_list);
+		mp->free_list = block;
+		mp->used--;
 		memory_used--;
 	}
 	__enable_irq();
@@ -164,6 +190,8 @@ void AudioStream::transmit(audio_block_t *block, unsigned char index)
 			if (c->dst->inputQueue[c->dest_index] == NULL) {
 				c->dst->inputQueue[c->dest_index] = block;
 				block->ref_count++;
+			} else {
+				c->dropped++;
 			}
 		}
 	}
@@ -205,7 +233,8 @@ audio_block_t * AudioStream::receiveWritable(unsigned int index)
 AudioConnection::AudioConnection() 
 	: src(NULL), dst(NULL),
 	  src_index(0), dest_index(0),
-	  isConnected(false)
+	  isConnected(false),
+	  dropped(0), reclaimed(0)
 
 {
 	// we are unused right now, so
@@ -321,6 +350,7 @@ int AudioConnection::connect(void)
 		dst->active = true;
 
 		isConnected = true;
+		AudioStream::update_order_needed = true;
 		
 		result = 0;
 	} while (0);
@@ -403,6 +433,7 @@ int AudioConnection::disconnect(void)
 	isConnected = false;
 	next_dest = dst->unused;
 	dst->unused = this;
+	AudioStream::update_order_needed = true;
 
 	__enable_irq();
 	
@@ -417,6 +448,36 @@ int AudioConnection::disconnect(void)
 // their constructors.
 bool AudioStream::update_scheduled = false;
 
+#if defined(AUDIO_HOST_SIMULATION)
+uint64_t AudioStream::sample_clock = 0;
+
+bool AudioStream::update_setup(void)
+{
+	if (update_scheduled) return false;
+	update_scheduled = true;
+	return true;
+}
+
+void AudioStream::update_stop(void)
+{
+	update_scheduled = false;
+}
+
+// Without a software interrupt, an update request from I/O objects
+// runs the whole graph immediately
+void AudioStream::update_all(void)
+{
+	software_isr();
+}
+
+void AudioStream::simulate(unsigned int blocks)
+{
+	while (blocks-- > 0) {
+		software_isr();
+		sample_clock += AUDIO_BLOCK_SAMPLES;
+	}
+}
+#else
 bool AudioStream::update_setup(void)
 {
 	if (update_scheduled) return false;
@@ -432,32 +493,124 @@ void AudioStream::update_stop(void)
 	NVIC_DISABLE_IRQ(IRQ_SOFTWARE);
 	update_scheduled = false;
 }
+#endif
 
 AudioStream * AudioStream::first_update = NULL;
 
+bool AudioStream::update_order_needed = false;
+
+#define SORT_NEW	0
+#define SORT_ACTIVE	1
+#define SORT_DONE	2
+
+// Sort the update list so every object runs after all objects feeding
+// its inputs.  Otherwise each connection going backwards in the list
+// delays its audio by 1 block.  This is a depth first search along the
+// connections, with each object placed ahead of the others once all
+// objects it feeds are placed.  A connection back to an object still
+// being searched closes a feedback loop, so it must go against data flow
+// order, and it is counted in feedback_loops.  The objects are searched
+// last to first, so objects which don't depend on each other keep their
+// previous order.  Runs from software_isr() after connections change,
+// so connect() and disconnect() stay quick.
+void AudioStream::update_order(void)
+{
+	AudioStream *p, *next, *root, *reversed = NULL, *head = NULL;
+	AudioConnection *c;
+	uint16_t loops = 0;
+
+	update_order_needed = false;
+	for (p = first_update; p; p = next) {
+		next = p->next_update;
+		p->next_update = reversed;
+		reversed = p;
+		p->sort_state = SORT_NEW;
+	}
+	// next_update is the reversed list while searching, sort_link is the
+	// parent while an object is active and the new order once it's done
+	for (root = reversed; root; root = root->next_update) {
+		if (root->sort_state != SORT_NEW) continue;
+		root->sort_state = SORT_ACTIVE;
+		root->sort_edge = root->destination_list;
+		root->sort_link = NULL;
+		p = root;
+		while (p) {
+			c = p->sort_edge;
+			if (c) {
+				p->sort_edge = c->next_dest;
+				AudioStream *dst = c->dst;
+				if (dst->sort_state == SORT_NEW) {
+					dst->sort_state = SORT_ACTIVE;
+					dst->sort_edge = dst->destination_list;
+					dst->sort_link = p;
+					p = dst;
+				} else if (dst->sort_state == SORT_ACTIVE) {
+					loops++;
+				}
+			} else {
+				next = p->sort_link;
+				p->sort_state = SORT_DONE;
+				p->sort_link = head;
+				head = p;
+				p = next;
+			}
+		}
+	}
+	for (p = head; p; p = p->sort_link) {
+		p->next_update = p->sort_link;
+	}
+	first_update = head;
+	feedback_loops = loops;
+}
+
+// Release input blocks an object did not receive during its update.
+// Anything still queued now arrived before the update, so keeping it
+// would only hold pool memory and cause newer blocks to be dropped.
+// Normally every update() receives all inputs, so this is a quick
+// check.  Finding the connection to count against is slow, but only
+// happens for objects which actually leave blocks behind.
+void AudioStream::release_unused_inputs(void)
+{
+	for (unsigned int i=0; i < num_inputs; i++) {
+		audio_block_t *block = inputQueue[i];
+		if (block == NULL) continue;
+		inputQueue[i] = NULL;
+		release(block);
+		for (AudioStream *s = first_update; s; s = s->next_update) {
+			for (AudioConnection *c = s->destination_list; c != NULL; c = c->next_dest) {
+				if (c->dst == this && c->dest_index == i) {
+					c->reclaimed++;
+				}
+			}
+		}
+	}
+}
+
 void software_isr(void) // AudioStream::update_all()
 {
 	AudioStream *p;
 
-	uint32_t totalcycles = ARM_DWT_CYCCNT;
+	if (AudioStream::update_order_needed) AudioStream::update_order();
+	uint32_t totalcycles = AUDIO_CYCLE_COUNT();
 	//digitalWriteFast(2, HIGH);
 	for (p = AudioStream::first_update; p; p = p->next_update) {
 		if (p->active) {
-			uint32_t cycles = ARM_DWT_CYCCNT;
+			uint32_t cycles = AUDIO_CYCLE_COUNT();
 			p->update();
-			// TODO: traverse inputQueueArray and release
-			// any input blocks that weren't consumed?
-			cycles = (ARM_DWT_CYCCNT - cycles) >> 6;
+			p->release_unused_inputs();
+			cycles = (AUDIO_CYCLE_COUNT() - cycles) >> 6;
 			p->cpu_cycles = cycles;
 			if (cycles > p->cpu_cycles_max) p->cpu_cycles_max = cycles;
 		}
 	}
 	//digitalWriteFast(2, LOW);
-	totalcycles = (ARM_DWT_CYCCNT - totalcycles) >> 6;
+	totalcycles = (AUDIO_CYCLE_COUNT() - totalcycles) >> 6;
 	AudioStream::cpu_cycles_total = totalcycles;
 	if (totalcycles > AudioStream::cpu_cycles_total_max)
 		AudioStream::cpu_cycles_total_max = totalcycles;
 
+#if !defined(AUDIO_HOST_SIMULATION)
 	asm("DSB");
+#endif
 }
 
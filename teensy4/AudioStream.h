@@ -37,6 +37,31 @@
 
 #endif
 
+// AUDIO_HOST_SIMULATION builds AudioStream and AudioConnection for a normal
+// computer (Linux), so audio graphs can be run and benchmarked without any
+// Teensy hardware.  There is no software interrupt, no cycle counter and no
+// DMAMEM.  Updates happen only when AudioStream::simulate() is called, which
+// advances a virtual sample clock one block at a time, as fast as the host
+// can run.  cpu_cycles and cpu_cycles_max record wall clock nanoseconds
+// (divided by 64, same scale as the cycle counts), so with F_CPU_ACTUAL
+// defined as 1 GHz AudioProcessorUsage() reports percent of real time.
+#if defined(AUDIO_HOST_SIMULATION) && !defined(__ASSEMBLER__)
+#include <stdint.h>
+#ifndef DMAMEM
+#define DMAMEM
+#endif
+#ifndef FLASHMEM
+#define FLASHMEM
+#endif
+#ifndef F_CPU_ACTUAL
+#define F_CPU_ACTUAL 1000000000
+#endif
+#ifndef __disable_irq
+#define __disable_irq()
+#define __enable_irq()
+#endif
+#endif
+
 // AUDIO_BLOCK_SAMPLES determines how many samples the audio library processes
 // per update.  It may be reduced to achieve lower latency response to events,
 // at the expense of higher interrupt and DMA setup overhead.
@@ -71,11 +96,28 @@ class AudioDebug;  // for testing only, never for public release
 
 typedef struct audio_block_struct {
 	uint8_t  ref_count;
-	uint8_t  reserved1;
+	uint8_t  memory_pool_number;
 	uint16_t memory_pool_index;
 	int16_t  data[AUDIO_BLOCK_SAMPLES];
 } audio_block_t;
 
+// Audio blocks may come from several pools.  AudioMemory() sets up the
+// general pool used by default.  Objects may ask for blocks from the fast
+// pool (DTCM, for low latency processing) or the bulk pool (PSRAM on
+// Teensy 4.1, for long delay lines).  When those pools are not set up or are
+// used up, blocks come from the general pool.
+#define AUDIO_MEMORY_GENERAL	0
+#define AUDIO_MEMORY_FAST	1
+#define AUDIO_MEMORY_BULK	2
+#define AUDIO_MEMORY_POOLS	3
+
+typedef struct audio_memory_pool_struct {
+	audio_block_t *free_list; // unused blocks, linked through their data
+	uint16_t num;
+	uint16_t used;
+	uint16_t used_max;
+} audio_memory_pool_t;
+
 
 
 class AudioConnection
@@ -94,6 +136,11 @@ public:
 	int connect(AudioStream &source, AudioStream &destination) {return connect(source,0,destination,0);};
 	int connect(AudioStream &source, unsigned char sourceOutput,
 		AudioStream &destination, unsigned char destinationInput);
+	// blocks not delivered because the destination input was still full
+	uint32_t blocksDropped(void) { return dropped; }
+	// blocks the destination left unused, released after its update
+	uint32_t blocksReclaimed(void) { return reclaimed; }
+	void blockCountersReset(void) { dropped = 0; reclaimed = 0; }
 protected:
 	AudioStream* src;	// can't use references as... 
 	AudioStream* dst;	// ...they can't be re-assigned!
@@ -101,6 +148,8 @@ protected:
 	unsigned char dest_index;
 	AudioConnection *next_dest; // linked list of connections from one source
 	bool isConnected;
+	uint32_t dropped;
+	uint32_t reclaimed;
 #if defined(AUDIO_DEBUG_CLASS)
 	friend class AudioDebug;
 #endif // defined(AUDIO_DEBUG_CLASS)
@@ -112,6 +161,26 @@ protected:
 	AudioStream::initialize_memory(data, num); \
 })
 
+#define AudioMemoryFast(num) ({ \
+	static audio_block_t data[num]; \
+	AudioStream::initialize_memory(data, num, AUDIO_MEMORY_FAST); \
+})
+
+// The bulk pool is only useful in PSRAM, since AudioMemory() already
+// uses DMAMEM.  Without PSRAM, this does nothing and the blocks come
+// from AudioMemory().
+#if defined(ARDUINO_TEENSY41) && !defined(AUDIO_HOST_SIMULATION)
+extern "C" uint8_t external_psram_size;
+#define AudioMemoryBulk(num) ({ \
+	static EXTMEM audio_block_t data[num]; \
+	if (external_psram_size > 0) { \
+		AudioStream::initialize_memory(data, num, AUDIO_MEMORY_BULK); \
+	} \
+})
+#else
+#define AudioMemoryBulk(num) ({ })
+#endif
+
 #define CYCLE_COUNTER_APPROX_PERCENT(n) (((float)((uint32_t)(n) * 6400u) * (float)(AUDIO_SAMPLE_RATE_EXACT / AUDIO_BLOCK_SAMPLES)) / (float)(F_CPU_ACTUAL))
 
 #define AudioProcessorUsage() (CYCLE_COUNTER_APPROX_PERCENT(AudioStream::cpu_cycles_total))
@@ -120,6 +189,10 @@ protected:
 #define AudioMemoryUsage() (AudioStream::memory_used)
 #define AudioMemoryUsageMax() (AudioStream::memory_used_max)
 #define AudioMemoryUsageMaxReset() (AudioStream::memory_used_max = AudioStream::memory_used)
+#define AudioMemoryPoolUsage(pool) (AudioStream::memory_pools[pool].used)
+#define AudioMemoryPoolUsageMax(pool) (AudioStream::memory_pools[pool].used_max)
+#define AudioMemoryPoolUsageMaxReset(pool) (AudioStream::memory_pools[pool].used_max = AudioStream::memory_pools[pool].used)
+#define AudioFeedbackLoops() (AudioStream::feedback_loops)
 
 class AudioStream
 {
@@ -131,8 +204,13 @@ public:
 			for (int i=0; i < num_inputs; i++) {
 				inputQueue[i] = NULL;
 			}
-			// add to a simple list, for update_all
-			// TODO: replace with a proper data flow analysis in update_all
+			// add to the list for update_all, which update_order()
+			// sorts into data flow order after connections change.
+			// The audio interrupt rewrites the list while sorting, so
+			// objects created with new while audio runs must not
+			// append to it with interrupts enabled.
+			__disable_irq();
+			next_update = NULL;
 			if (first_update == NULL) {
 				first_update = this;
 			} else {
@@ -140,12 +218,14 @@ public:
 				for (p=first_update; p->next_update; p = p->next_update) ;
 				p->next_update = this;
 			}
-			next_update = NULL;
+			update_order_needed = true;
+			__enable_irq();
 			cpu_cycles = 0;
 			cpu_cycles_max = 0;
 			numConnections = 0;
 		}
-	static void initialize_memory(audio_block_t *data, unsigned int num);
+	static void initialize_memory(audio_block_t *data, unsigned int num,
+		unsigned int pool = AUDIO_MEMORY_GENERAL);
 	float processorUsage(void) { return CYCLE_COUNTER_APPROX_PERCENT(cpu_cycles); }
 	float processorUsageMax(void) { return CYCLE_COUNTER_APPROX_PERCENT(cpu_cycles_max); }
 	void processorUsageMaxReset(void) { cpu_cycles_max = cpu_cycles; }
@@ -156,17 +236,31 @@ public:
 	static uint16_t cpu_cycles_total_max;
 	static uint16_t memory_used;
 	static uint16_t memory_used_max;
+	static audio_memory_pool_t memory_pools[AUDIO_MEMORY_POOLS];
+	// number of connections which had to be updated out of data flow order,
+	// each adding 1 block of latency, because the graph has feedback loops.
+	// Updated at the next audio update after connections change.
+	static uint16_t feedback_loops;
 protected:
 	bool active;
 	unsigned char num_inputs;
-	static audio_block_t * allocate(void);
+	static audio_block_t * allocate(unsigned int pool = AUDIO_MEMORY_GENERAL);
 	static void release(audio_block_t * block);
 	void transmit(audio_block_t *block, unsigned char index = 0);
 	audio_block_t * receiveReadOnly(unsigned int index = 0);
 	audio_block_t * receiveWritable(unsigned int index = 0);
 	static bool update_setup(void);
 	static void update_stop(void);
+#if defined(AUDIO_HOST_SIMULATION)
+public:
+	// run the graph for a number of blocks, advancing the virtual sample clock
+	static void simulate(unsigned int blocks = 1);
+	static uint64_t simulation_samples(void) { return sample_clock; }
+protected:
+	static void update_all(void);
+#else
 	static void update_all(void) { NVIC_SET_PENDING(IRQ_SOFTWARE); }
+#endif
 	friend void software_isr(void);
 	friend class AudioConnection;
 #if defined(AUDIO_DEBUG_CLASS)
@@ -181,9 +275,16 @@ private:
 	virtual void update(void) = 0;
 	static AudioStream *first_update; // for update_all
 	AudioStream *next_update; // for update_all
-	static audio_block_t *memory_pool;
-	static uint32_t memory_pool_available_mask[];
-	static uint16_t memory_pool_first_mask;
+	static bool update_order_needed;
+	static void update_order(void);
+	void release_unused_inputs(void);
+	// for update_order
+	AudioStream *sort_link;
+	AudioConnection *sort_edge;
+	uint8_t sort_state;
+#if defined(AUDIO_HOST_SIMULATION)
+	static uint64_t sample_clock;
+#endif
 };
 
 #if defined(AUDIO_DEBUG_CLASS)
@@ -33,15 +33,65 @@
 
 #include <Arduino.h>
 #include "EventResponder.h"
+#include "Fiber.h"
 
-EventResponder * EventResponder::firstYield = nullptr;
-EventResponder * EventResponder::lastYield = nullptr;
-EventResponder * EventResponder::firstInterrupt = nullptr;
-EventResponder * EventResponder::lastInterrupt = nullptr;
+EventResponder * EventResponder::firstYield[EventResponder::priorityLevels];
+EventResponder * EventResponder::lastYield[EventResponder::priorityLevels];
+EventResponder * EventResponder::firstInterrupt[EventResponder::priorityLevels];
+EventResponder * EventResponder::lastInterrupt[EventResponder::priorityLevels];
+volatile uint8_t EventResponder::yieldPending = 0;
+volatile uint8_t EventResponder::interruptPending = 0;
 bool EventResponder::runningFromYield = false;
+uint16_t EventResponder::yieldSequence = 0;
+uint16_t EventResponder::yieldMaxEvents = 8;
+uint32_t EventResponder::yieldMaxMicroseconds = 0;
 
-// TODO: interrupt disable/enable needed in many places!!!
-// BUGBUG: See if file name order makes difference?
+// add to the end of the list for our priority level
+void EventResponder::enqueue(EventResponder **first, EventResponder **last, volatile uint8_t &pending)
+{
+	_next = nullptr;
+	_prev = last[_priority];
+	if (_prev) {
+		_prev->_next = this;
+	} else {
+		first[_priority] = this;
+	}
+	last[_priority] = this;
+	pending |= (1 << _priority);
+}
+
+void EventResponder::unlink(EventResponder **first, EventResponder **last, volatile uint8_t &pending)
+{
+	if (_prev) {
+		_prev->_next = _next;
+	} else {
+		first[_priority] = _next;
+	}
+	if (_next) {
+		_next->_prev = _prev;
+	} else {
+		last[_priority] = _prev;
+	}
+	if (first[_priority] == nullptr) pending &= ~(1 << _priority);
+}
+
+// remove the first event of the highest priority level
+EventResponder * EventResponder::dequeue(EventResponder **first, EventResponder **last, volatile uint8_t &pending)
+{
+	uint32_t bits = pending;
+	if (bits == 0) return nullptr;
+	int level = __builtin_ctz(bits);
+	EventResponder *event = first[level];
+	first[level] = event->_next;
+	if (first[level]) {
+		first[level]->_prev = nullptr;
+	} else {
+		last[level] = nullptr;
+		pending = bits & ~(1 << level);
+	}
+	event->_triggered = false;
+	return event;
+}
 
 void EventResponder::triggerEventNotImmediate()
 {
@@ -50,30 +100,11 @@ void EventResponder::triggerEventNotImmediate()
 		// not already triggered
 		if (_type == EventTypeYield) {
 			// normal type, called from yield()
-			if (firstYield == nullptr) {
-				_next = nullptr;
-				_prev = nullptr;
-				firstYield = this;
-				lastYield = this;
-			} else {
-				_next = nullptr;
-				_prev = lastYield;
-				_prev->_next = this;
-				lastYield = this;
-			}
+			_sequence = yieldSequence++;
+			enqueue(firstYield, lastYield, yieldPending);
 		} else if (_type == EventTypeInterrupt) {
 			// interrupt, called from software interrupt
-			if (firstInterrupt == nullptr) {
-				_next = nullptr;
-				_prev = nullptr;
-				firstInterrupt = this;
-				lastInterrupt = this;
-			} else {
-				_next = nullptr;
-				_prev = lastInterrupt;
-				_prev->_next = this;
-				lastInterrupt = this;
-			}
+			enqueue(firstInterrupt, lastInterrupt, interruptPending);
 			SCB_ICSR = SCB_ICSR_PENDSVSET; // set PendSV interrupt
 		} else {
 			// detached, easy :-)
@@ -83,30 +114,74 @@ void EventResponder::triggerEventNotImmediate()
 	enableInterrupts(irq);
 }
 
+void EventResponder::runYieldEvents()
+{
+	// First, check if yield was called from an interrupt
+	// never call normal handler functions from any interrupt context
+	uint32_t ipsr;
+	__asm__ volatile("mrs %0, ipsr\n" : "=r" (ipsr)::);
+	if (ipsr != 0) return;
+	// Next, make sure we're not being recursively called,
+	// which can happen if the user's function does anything
+	// that calls yield.
+	if (runningFromYield) return;
+	runningFromYield = true;
+	// Run the highest priority events, until none remain or this
+	// yield's budget is used up.  Events triggered after this began,
+	// including by the functions run here, wait for the next yield.
+	uint32_t count = 0;
+	uint32_t begin = ARM_DWT_CYCCNT;
+	uint32_t maxCycles = yieldMaxMicroseconds * (F_CPU_ACTUAL / 1000000);
+	bool irq = disableInterrupts();
+	uint16_t sequence = yieldSequence;
+	enableInterrupts(irq);
+	while (1) {
+		EventResponder *event = nullptr;
+		irq = disableInterrupts();
+		uint32_t bits = yieldPending;
+		while (bits) {
+			// each level's list is in the order triggered
+			int level = __builtin_ctz(bits);
+			EventResponder *first = firstYield[level];
+			if ((int16_t)(first->_sequence - sequence) < 0) {
+				first->unlink(firstYield, lastYield, yieldPending);
+				first->_triggered = false;
+				event = first;
+				break;
+			}
+			bits &= bits - 1;
+		}
+		enableInterrupts(irq);
+		if (event == nullptr) break;
+		(*(event->_function))(*event);
+		if (++count == yieldMaxEvents) break;
+		if (maxCycles && ARM_DWT_CYCCNT - begin >= maxCycles) break;
+	}
+	runningFromYield = false;
+}
+
+void EventResponder::setYieldBudget(uint16_t maxEvents, uint32_t maxMicroseconds)
+{
+	// converted to cycles in each yield, in case the CPU speed changes
+	yieldMaxEvents = maxEvents;
+	yieldMaxMicroseconds = maxMicroseconds;
+}
+
 extern "C" void pendablesrvreq_isr(void)
 {
 	EventResponder::runFromInterrupt();
 }
 
+// Run all interrupt events, highest priority first.  Events triggered
+// while this runs are also run, in priority order.
 void EventResponder::runFromInterrupt()
 {
 	while (1) {
 		bool irq = disableInterrupts();
-		EventResponder *first = firstInterrupt;
-		if (first) {
-			firstInterrupt = first->_next;
-			if (firstInterrupt) {
-				firstInterrupt->_prev = nullptr;
-			} else {
-				lastInterrupt = nullptr;
-			}
-			enableInterrupts(irq);
-			first->_triggered = false;
-			(*(first->_function))(*first);
-		} else {
-			enableInterrupts(irq);
-			break;
-		}
+		EventResponder *event = dequeue(firstInterrupt, lastInterrupt, interruptPending);
+		enableInterrupts(irq);
+		if (event == nullptr) break;
+		(*(event->_function))(*event);
 	}
 }
 
@@ -116,27 +191,9 @@ bool EventResponder::clearEvent()
 	bool irq = disableInterrupts();
 	if (_triggered) {
 		if (_type == EventTypeYield) {
-			if (_prev) {
-				_prev->_next = _next;
-			} else {
-				firstYield = _next;
-			}
-			if (_next) {
-				_next->_prev = _prev;
-			} else {
-				lastYield = _prev;
-			}
+			unlink(firstYield, lastYield, yieldPending);
 		} else if (_type == EventTypeInterrupt) {
-			if (_prev) {
-				_prev->_next = _next;
-			} else {
-				firstInterrupt = _next;
-			}
-			if (_next) {
-				_next->_prev = _prev;
-			} else {
-				lastInterrupt = _prev;
-			}
+			unlink(firstInterrupt, lastInterrupt, interruptPending);
 		}
 		_triggered = false;
 		ret = true;
@@ -145,36 +202,31 @@ bool EventResponder::clearEvent()
 	return ret;
 }
 
+bool EventResponder::waitForEvent(EventResponderRef event, int timeout)
+{
+	return Fiber::waitForEvent(event, timeout);
+}
+
+EventResponder * EventResponder::waitForEvent(EventResponder *list, int listsize, int timeout)
+{
+	uint32_t begin = millis();
+	while (1) {
+		for (int i=0; i < listsize; i++) {
+			if (list[i].clearEvent()) return &list[i];
+		}
+		if (timeout >= 0 && millis() - begin >= (uint32_t)timeout) return nullptr;
+		yield(); // from a fiber, other fibers and loop() run meanwhile
+	}
+}
+
 // this detach must be called with interrupts disabled
 void EventResponder::detachNoInterrupts()
 {
 	if (_type == EventTypeYield) {
-		if (_triggered) {
-			if (_prev) {
-				_prev->_next = _next;
-			} else {
-				firstYield = _next;
-			}
-			if (_next) {
-				_next->_prev = _prev;
-			} else {
-				lastYield = _prev;
-			}
-		}
+		if (_triggered) unlink(firstYield, lastYield, yieldPending);
 		_type = EventTypeDetached;
 	} else if (_type == EventTypeInterrupt) {
-		if (_triggered) {
-			if (_prev) {
-				_prev->_next = _next;
-			} else {
-				firstInterrupt = _next;
-			}
-			if (_next) {
-				_next->_prev = _prev;
-			} else {
-				lastInterrupt = _prev;
-			}
-		}
+		if (_triggered) unlink(firstInterrupt, lastInterrupt, interruptPending);
 		_type = EventTypeDetached;
 	}
 }
@@ -184,7 +236,9 @@ void EventResponder::detachNoInterrupts()
 
 
 MillisTimer * MillisTimer::listWaiting = nullptr;
-MillisTimer * MillisTimer::listActive = nullptr;
+MillisTimer * MillisTimer::wheel[MillisTimer::wheelLevels][MillisTimer::wheelSize];
+uint32_t MillisTimer::wheelTime = 0;
+uint32_t MillisTimer::maxCycles = 0;
 
 void MillisTimer::begin(unsigned long milliseconds, EventResponderRef event)
 {
@@ -208,7 +262,7 @@ void MillisTimer::beginRepeating(unsigned long milliseconds, EventResponderRef e
 
 void MillisTimer::addToWaitingList()
 {
-	_prev = nullptr;
+	_pprev = nullptr;
 	bool irq = disableTimerInterrupt();
 	_next = listWaiting;
 	listWaiting = this; // TODO: use STREX to avoid interrupt disable
@@ -218,42 +272,18 @@ void MillisTimer::addToWaitingList()
 
 void MillisTimer::addToActiveList() // only called by runFromTimer()
 {
-	if (listActive == nullptr) {
-		// list is empty, easy case
-		_next = nullptr;
-		_prev = nullptr;
-		listActive = this;
-	} else if (_ms < listActive->_ms) {
-		// this timer triggers before any on the list
-		_next = listActive;
-		_prev = nullptr;
-		listActive->_prev = this;
-		// Decrement the next items wait time be our wait time as to properly handle waits for all other items...
-		listActive->_ms -= _ms;	
-		listActive = this;
-	} else {
-		// add this timer somewhere after the first already on the list
-		MillisTimer *timer = listActive;
-		while (timer->_next) {
-			_ms -= timer->_ms;
-			timer = timer->_next;
-			if (_ms < timer->_ms) {
-				// found the right place in the middle of list
-				_next = timer;
-				_prev = timer->_prev;
-				timer->_prev = this;
-				_prev->_next = this;
-				timer->_ms -= _ms;
-				_state = TimerActive;
-				return;
-			}
-		}
-		// add this time at the end of the list
-		_ms -= timer->_ms;
-		_next = nullptr;
-		_prev = timer;
-		timer->_next = this;
+	// the level is chosen by how far away _expires is, the slot within
+	// the level by the bits of _expires which that level counts
+	uint32_t delta = _expires - wheelTime;
+	int level = 0;
+	while (level < wheelLevels-1 && delta >= (1ul << (wheelBits * (level + 1)))) {
+		level++;
 	}
+	MillisTimer **slot = &wheel[level][(_expires >> (wheelBits * level)) & (wheelSize - 1)];
+	_next = *slot;
+	if (_next) _next->_pprev = &_next;
+	_pprev = slot;
+	*slot = this;
 	_state = TimerActive;
 }
 
@@ -262,15 +292,8 @@ void MillisTimer::end()
 	bool irq = disableTimerInterrupt();
 	TimerStateType s = _state;
 	if (s == TimerActive) {
-		if (_next) {
-			_next->_prev = _prev;
-			_next->_ms += _ms;   // add in the rest of our timing to next entry...
-		}
-		if (_prev) {
-			_prev->_next = _next;
-		} else {
-			listActive = _next;
-		}
+		*_pprev = _next;
+		if (_next) _next->_pprev = _pprev;
 		_state = TimerOff;
 	} else if (s == TimerWaiting) {
 		if (listWaiting == this) {
@@ -287,39 +310,61 @@ void MillisTimer::end()
 		}
 		_state = TimerOff;
 	}
+	_reload = 0; // also stops a repeating timer from its own event
 	enableTimerInterrupt(irq);
 }
 
 void MillisTimer::runFromTimer()
 {
-	MillisTimer *timer = listActive;
-	while (timer) {
-		if (timer->_ms > 0) {
-			timer->_ms--;
-			break;
-		} else {
-			MillisTimer *next = timer->_next;
-			if (next) next->_prev = nullptr;
-			listActive = next;
-			timer->_state = TimerOff;
-			EventResponderRef event = *(timer->_event);
-			event.triggerEvent(0, timer);
-			if (timer->_reload) {
-				timer->_ms = timer->_reload;
+	uint32_t cycles = ARM_DWT_CYCCNT;
+	uint32_t now = wheelTime;
+	uint32_t index = now & (wheelSize - 1);
+
+	if (index == 0) {
+		// level 0 wrapped, move the next slot of higher levels down
+		for (int level=1; level < wheelLevels; level++) {
+			uint32_t i = (now >> (wheelBits * level)) & (wheelSize - 1);
+			MillisTimer *timer = wheel[level][i];
+			wheel[level][i] = nullptr;
+			while (timer) {
+				MillisTimer *next = timer->_next;
 				timer->addToActiveList();
+				timer = next;
 			}
-			timer = listActive;
+			if (i != 0) break;
+		}
+	}
+	// every timer in this slot expires now.  Events may end other timers
+	// in the list, so it stays linked while we work through it.
+	MillisTimer *list = wheel[0][index];
+	wheel[0][index] = nullptr;
+	if (list) list->_pprev = &list;
+	while (list) {
+		MillisTimer *timer = list;
+		list = timer->_next;
+		if (list) list->_pprev = &list;
+		timer->_state = TimerOff;
+		EventResponderRef event = *(timer->_event);
+		event.triggerEvent(0, timer);
+		if (timer->_reload && timer->_state == TimerOff) {
+			timer->_expires = now + timer->_reload;
+			timer->addToActiveList();
 		}
 	}
+	wheelTime = now + 1;
+
 	bool irq = disableTimerInterrupt();
 	MillisTimer *waiting = listWaiting;
 	listWaiting = nullptr; // TODO: use STREX to avoid interrupt disable
 	enableTimerInterrupt(irq);
 	while (waiting) {
 		MillisTimer *next = waiting->_next;
+		waiting->_expires = wheelTime + waiting->_ms;
 		waiting->addToActiveList();
 		waiting = next;
 	}
+	cycles = ARM_DWT_CYCCNT - cycles;
+	if (cycles > maxCycles) maxCycles = cycles;
 }
 
 // Long ago you could install your own systick interrupt handler by just
@@ -58,6 +58,11 @@
  * including the status integer and data pointer, are overwritten and
  * your function is called only one time, based on the last trigger
  * event.
+ *
+ * When several events are waiting, they are run in priority order.
+ * Lower numbers are higher priority, with 0 the highest and 255 the
+ * lowest, grouped into 8 levels of 32.  Events with the same level run
+ * in the order they were triggered.
  */
 extern "C" void systick_isr_with_timer_events(void);
 
@@ -83,11 +88,12 @@ public:
 	// Attach a function to be called from yield().  This should be the
 	// default way to use EventResponder.  Calls from yield() allow use
 	// of Arduino libraries, String, Serial, etc.
-	void attach(EventResponderFunction function, uint8_t priority __attribute__((unused)) = 128) {
+	void attach(EventResponderFunction function, uint8_t priority = 128) {
 		bool irq = disableInterrupts();
 		detachNoInterrupts();
 		_function = function;
 		_type = EventTypeYield;
+		_priority = priority >> 5;
 		yield_active_check_flags |= YIELD_CHECK_EVENT_RESPONDER; // user setup a yield type...
 		enableInterrupts(irq);
 	}
@@ -108,11 +114,12 @@ public:
 	// this as attachImmediate.  On ARM and other platforms with software
 	// interrupts, this allow fast interrupt-based response, but with less
 	// disruption to other libraries requiring their own interrupts.
-	void attachInterrupt(EventResponderFunction function, uint8_t priority __attribute__((unused)) = 128) {
+	void attachInterrupt(EventResponderFunction function, uint8_t priority = 128) {
 		bool irq = disableInterrupts();
 		detachNoInterrupts();
 		_function = function;
 		_type = EventTypeInterrupt;
+		_priority = priority >> 5;
 		SCB_SHPR3 |= 0x00FF0000; // configure PendSV, lowest priority
 		// Make sure we are using the systic ISR that process this
 		_VectorsRam[15] = systick_isr_with_timer_events;
@@ -173,44 +180,27 @@ public:
 	bool waitForEvent(EventResponderRef event, int timeout);
 	EventResponder * waitForEvent(EventResponder *list, int listsize, int timeout);
 	static void runFromYield() {
-		if (!firstYield) return;  
-		// First, check if yield was called from an interrupt
-		// never call normal handler functions from any interrupt context
-		uint32_t ipsr;
-		__asm__ volatile("mrs %0, ipsr\n" : "=r" (ipsr)::);
-		if (ipsr != 0) return;
-		// Next, check if any events have been triggered
-		bool irq = disableInterrupts();
-		EventResponder *first = firstYield;
-		if (first == nullptr) {
-			enableInterrupts(irq);
-			return;
-		}
-		// Finally, make sure we're not being recursively called,
-		// which can happen if the user's function does anything
-		// that calls yield.
-		if (runningFromYield) {
-			enableInterrupts(irq);
-			return;
-		}
-		// Ok, update the runningFromYield flag and process event
-		runningFromYield = true;
-		firstYield = first->_next;
-		if (firstYield) {
-			firstYield->_prev = nullptr;
-		} else {
-			lastYield = nullptr;
-		}
-		enableInterrupts(irq);
-		first->_triggered = false;
-		(*(first->_function))(*first);
-		runningFromYield = false;
+		if (!yieldPending) return;
+		runYieldEvents();
 	}
+	// Limit the work each yield() does running event functions: at most
+	// maxEvents functions (0 for no limit), and no new function is started
+	// after maxMicroseconds (0 for no limit).  The default is 8 events,
+	// so events triggered faster than yield() is called don't pile up.
+	// Either way, each yield() only runs events which were triggered
+	// before it began, so an event which triggers itself runs once.
+	static void setYieldBudget(uint16_t maxEvents, uint32_t maxMicroseconds = 0);
 	static void runFromInterrupt();
 	operator bool() { return _triggered; }
 protected:
 	void triggerEventNotImmediate();
 	void detachNoInterrupts();
+	static void runYieldEvents();
+	static constexpr int priorityLevels = 8;
+	// list functions, must be called with interrupts disabled
+	void enqueue(EventResponder **first, EventResponder **last, volatile uint8_t &pending);
+	void unlink(EventResponder **first, EventResponder **last, volatile uint8_t &pending);
+	static EventResponder * dequeue(EventResponder **first, EventResponder **last, volatile uint8_t &pending);
 	int _status = 0;
 	EventResponderFunction _function = nullptr;
 	void *_data = nullptr;
@@ -219,11 +209,20 @@ protected:
 	EventResponder *_prev = nullptr;
 	EventType _type = EventTypeDetached;
 	bool _triggered = false;
-	static EventResponder *firstYield;
-	static EventResponder *lastYield;
-	static EventResponder *firstInterrupt;
-	static EventResponder *lastInterrupt;
+	uint8_t _priority = 4; // 0 to priorityLevels-1
+	uint16_t _sequence = 0; // order triggered, for yield events
+	// triggered events, one list per priority level.  The bits of
+	// yieldPending and interruptPending tell which lists are not empty.
+	static EventResponder *firstYield[priorityLevels];
+	static EventResponder *lastYield[priorityLevels];
+	static EventResponder *firstInterrupt[priorityLevels];
+	static EventResponder *lastInterrupt[priorityLevels];
+	static volatile uint8_t yieldPending;
+	static volatile uint8_t interruptPending;
 	static bool runningFromYield;
+	static uint16_t yieldSequence;
+	static uint16_t yieldMaxEvents;
+	static uint32_t yieldMaxMicroseconds;
 private:
 	static bool disableInterrupts() {
 		uint32_t primask;
@@ -248,13 +247,18 @@ public:
 	void beginRepeating(unsigned long milliseconds, EventResponderRef event);
 	void end();
 	static void runFromTimer();
+	// Longest time runFromTimer() has taken in the systick interrupt, in
+	// CPU cycles.  Divide by F_CPU_ACTUAL / 1000000 for microseconds.
+	static uint32_t isrCyclesMax() { return maxCycles; }
+	static void isrCyclesMaxReset() { maxCycles = 0; }
 private:
 	void addToWaitingList();
 	void addToActiveList();
 	unsigned long _ms = 0;
 	unsigned long _reload = 0;
+	uint32_t _expires = 0;
 	MillisTimer *_next = nullptr;
-	MillisTimer *_prev = nullptr;
+	MillisTimer **_pprev = nullptr; // the pointer to us, in the wheel
 	EventResponder *_event = nullptr;
 	enum TimerStateType {
 		TimerOff = 0,
@@ -263,7 +267,15 @@ private:
 	};
 	volatile TimerStateType _state = TimerOff;
 	static MillisTimer *listWaiting; // single linked list of waiting to start timers
-	static MillisTimer *listActive;  // double linked list of running timers
+	// Running timers are on a hierarchical timing wheel.  Level 0 has one
+	// slot per millisecond, each higher level's slot spans all of the level
+	// below, and is moved down when the lower level wraps around.
+	static constexpr int wheelBits = 6;
+	static constexpr int wheelSize = 1 << wheelBits;
+	static constexpr int wheelLevels = 6;
+	static MillisTimer *wheel[wheelLevels][wheelSize];
+	static uint32_t wheelTime; // the next millisecond to run
+	static uint32_t maxCycles;
 	static bool disableTimerInterrupt() {
 		uint32_t primask;
 		__asm__ volatile("mrs %0, primask\n" : "=r" (primask)::);
@@ -0,0 +1,200 @@
+/* Teensyduino Core Library
+ * http://www.pjrc.com/teensy/
+ * Copyright (c) 2017 PJRC.COM, LLC.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * 1. The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * 2. If the Software is incorporated into a build system that allows
+ * selection among a list of target devices, then similar target
+ * devices manufactured by PJRC.COM must be included in the list of
+ * target devices and selectable in the same manner.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include "Fiber.h"
+#include "EventResponder.h"
+
+Fiber * Fiber::first = nullptr;
+Fiber * Fiber::active = nullptr;
+uint32_t * Fiber::mainSP = nullptr;
+
+#define STACK_FILL 0xF1BEF1BE
+
+// The context fiber_switch() leaves on a suspended fiber's stack, lowest
+// address first.  "vpush {d8-d15}" stores below "push {r4-r11, lr}",
+// and each stores its lowest numbered register at the lowest address.
+// begin() builds the same frame, so the first switch pops it and
+// "returns" to entry().  Keep these in step with the asm below.
+struct fiber_context {
+	uint32_t d8_d15[16];	// vpush {d8-d15}: 8 double registers
+	uint32_t r4_r11[8];	// push {r4-r11, ...
+	uint32_t lr;		// ..., lr}, popped into pc
+};
+static_assert(sizeof(fiber_context) == (16 + 8 + 1) * 4, "fiber context frame size");
+static_assert(offsetof(fiber_context, r4_r11) == 16 * 4, "vpush frame precedes push frame");
+static_assert(offsetof(fiber_context, lr) == (16 + 8) * 4, "lr is the last word pushed");
+
+// Save the callee saved registers on the current stack, store the
+// stack pointer to *save, then continue with the context at restore.
+// Other registers are saved by the compiler at the call, as usual.
+__attribute__((naked, noinline))
+static void fiber_switch(uint32_t **save __attribute__((unused)),
+	uint32_t *restore __attribute__((unused)))
+{
+	asm volatile(
+		"push	{r4-r11, lr}\n"
+		"vpush	{d8-d15}\n"
+		"str	sp, [r0]\n"
+		"mov	sp, r1\n"
+		"vpop	{d8-d15}\n"
+		"pop	{r4-r11, pc}\n"
+	);
+}
+
+bool Fiber::begin(function_t function, void *arg, void *stack, size_t stacksize)
+{
+	if (state != Done || this == active) return false;
+	uint32_t *bottom = (uint32_t *)(((uint32_t)stack + 3) & ~3);
+	uint32_t *top = (uint32_t *)(((uint32_t)stack + stacksize) & ~7);
+	if (top - bottom < 64) return false;
+	for (uint32_t *p = bottom; p < top; p++) *p = STACK_FILL;
+	// the first switch to this fiber "returns" to entry()
+	fiber_context *context = (fiber_context *)top - 1;
+	context->lr = (uint32_t)entry;
+	sp = (uint32_t *)context;
+	stackBottom = bottom;
+	this->function = function;
+	this->arg = arg;
+	event = nullptr;
+	Fiber *f;
+	for (f = first; f; f = f->next) {
+		if (f == this) break;
+	}
+	if (!f) {
+		next = first;
+		first = this;
+	}
+	state = Ready;
+	yield_active_check_flags |= YIELD_CHECK_FIBERS;
+	return true;
+}
+
+size_t Fiber::stackUnused()
+{
+	if (!stackBottom) return 0;
+	uint32_t *p = stackBottom;
+	while (*p == STACK_FILL) p++;
+	return (p - stackBottom) * 4;
+}
+
+void Fiber::entry(void)
+{
+	Fiber *f = active;
+	f->function(f->arg);
+	f->state = Done;
+	runFromYield(); // never returns
+}
+
+void Fiber::unlist()
+{
+	for (Fiber **link = &first; *link; link = &(*link)->next) {
+		if (*link == this) {
+			*link = next;
+			break;
+		}
+	}
+}
+
+bool Fiber::ready()
+{
+	switch (state) {
+	case Ready:
+		return true;
+	case Sleeping:
+		if ((int32_t)(millis() - wakeTime) < 0) return false;
+		break;
+	case Waiting:
+		if (!*event && (!timed || (int32_t)(millis() - wakeTime) < 0)) return false;
+		break;
+	default:
+		return false;
+	}
+	state = Ready;
+	return true;
+}
+
+bool Fiber::runFromYield()
+{
+	// never switch stacks within an interrupt
+	uint32_t ipsr;
+	__asm__ volatile("mrs %0, ipsr\n" : "=r" (ipsr)::);
+	if (ipsr != 0) return false;
+
+	Fiber *f = active;
+	if (f) {
+		fiber_switch(&f->sp, mainSP);
+		return true;
+	}
+	for (f = first; f; ) {
+		if (f->ready()) {
+			active = f;
+			fiber_switch(&mainSP, f->sp);
+			active = nullptr;
+		}
+		Fiber *n = f->next;
+		if (f->state == Done) f->unlist();
+		f = n;
+	}
+	if (!first) yield_active_check_flags &= ~YIELD_CHECK_FIBERS;
+	return false;
+}
+
+void Fiber::sleep(uint32_t milliseconds)
+{
+	Fiber *f = active;
+	if (!f) {
+		delay(milliseconds);
+		return;
+	}
+	f->wakeTime = millis() + milliseconds;
+	f->state = Sleeping;
+	runFromYield();
+}
+
+bool Fiber::waitForEvent(EventResponder &event, int timeout)
+{
+	Fiber *f = active;
+	if (!f) {
+		uint32_t begin = millis();
+		while (!event) {
+			if (timeout >= 0 && millis() - begin >= (uint32_t)timeout) return false;
+			yield();
+		}
+		return event.clearEvent();
+	}
+	f->event = &event;
+	f->timed = (timeout >= 0);
+	f->wakeTime = millis() + timeout;
+	f->state = Waiting;
+	runFromYield();
+	f->event = nullptr;
+	return event.clearEvent();
+}
@@ -0,0 +1,103 @@
+/* Teensyduino Core Library
+ * http://www.pjrc.com/teensy/
+ * Copyright (c) 2017 PJRC.COM, LLC.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * 1. The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * 2. If the Software is incorporated into a build system that allows
+ * selection among a list of target devices, then similar target
+ * devices manufactured by PJRC.COM must be included in the list of
+ * target devices and selectable in the same manner.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef __cplusplus
+#ifndef Fiber_h_
+#define Fiber_h_
+
+#include <stddef.h>
+#include <stdint.h>
+
+class EventResponder;
+
+// Fiber runs a function with its own stack, sharing the CPU with loop()
+// and other fibers.  Whenever a fiber calls yield(), directly or from
+// delay(), Serial.write(), readBytes(), or any other function which
+// waits, the other fibers and loop() get to run.  Every fiber gets a
+// turn each time loop(), or a function it calls, calls yield().  Fibers
+// are never preempted, so they may share data, Serial, String, etc
+// without locking, but a fiber which never calls yield() stops all
+// others.  Several protocols can be written as simple blocking code,
+// each in its own fiber, instead of as hand-written state machines.
+class Fiber {
+public:
+	typedef void (*function_t)(void *arg);
+	constexpr Fiber() {
+	}
+	// Start running function(arg) using stack, which must remain valid
+	// until the function returns.  The stack must hold everything the
+	// function uses plus interrupt frames, so 2048 bytes is a reasonable
+	// start.  Returns false if this fiber is already running or the
+	// stack is too small.
+	bool begin(function_t function, void *arg, void *stack, size_t stacksize);
+	template <size_t N>
+	bool begin(function_t function, void *arg, uint32_t (&stack)[N]) {
+		return begin(function, arg, stack, sizeof(stack));
+	}
+	// Returns true until the fiber's function returns.
+	bool running() { return state != Done; }
+	// The number of bytes at the bottom of the stack never used so far.
+	size_t stackUnused();
+	// The currently running fiber, or nullptr when called from loop().
+	static Fiber * current() { return active; }
+	// Suspend the current fiber for a number of milliseconds.  When
+	// called from loop(), this is the same as delay().
+	static void sleep(uint32_t milliseconds);
+	// Suspend the current fiber until event has been triggered (for
+	// example by MillisTimer or an interrupt), or timeout milliseconds
+	// have elapsed, or forever if timeout is negative.  The event should
+	// be detached, so no function is called.  Returns true if the event
+	// was triggered, which also clears it.
+	static bool waitForEvent(EventResponder &event, int timeout = -1);
+	// Called by yield().  From a fiber, switch back to loop() and return
+	// true when the fiber is resumed.  From loop(), give every fiber
+	// which is ready a turn, and return false.
+	static bool runFromYield();
+private:
+	enum State : uint8_t { Done, Ready, Sleeping, Waiting };
+	bool ready();
+	void unlist();
+	static void entry(void);
+	uint32_t *sp = nullptr; // saved context, while not running
+	uint32_t *stackBottom = nullptr;
+	function_t function = nullptr;
+	void *arg = nullptr;
+	EventResponder *event = nullptr;
+	uint32_t wakeTime = 0;
+	volatile State state = Done;
+	bool timed = false;
+	Fiber *next = nullptr;
+	static Fiber *first;
+	static Fiber *active;
+	static uint32_t *mainSP;
+};
+
+#endif // Fiber_h_
+#endif // __cplusplus
@@ -31,6 +31,7 @@
 #include "HardwareSerial.h"
 #include "core_pins.h"
 #include "Arduino.h"
+#include "DMAChannel.h"
 //#include "debug/printf.h"
 
 /*typedef struct {
@@ -235,6 +236,9 @@ void HardwareSerialIMXRT::begin(uint32_t baud, uint16_t format)
 	// bit 8 can turn on 2 stop bit mote
 	if ( format & 0x100) port->BAUD |= LPUART_BAUD_SBNS;	
 
+	if (rx_dma_) rx_dma_begin();
+	if (tx_dma_) tx_dma_begin();
+
 	//Serial.printf("    stat:%x ctrl:%x fifo:%x water:%x\n", port->STAT, port->CTRL, port->FIFO, port->WATER );
 
 	// Enable the processing of serialEvent for this object, if user function exists.
@@ -252,12 +256,44 @@ inline void HardwareSerialIMXRT::rts_deassert()
 	DIRECT_WRITE_HIGH(rts_pin_baseReg_, rts_pin_bitmask_);
 }
 
+// In DMA mode, bring rx_buffer_head_ up to date with the receive DMA
+inline void HardwareSerialIMXRT::rx_dma_poll()
+{
+	if (rx_dma_) {
+		__disable_irq();
+		rx_dma_update();
+		__enable_irq();
+	}
+}
+
+// Store the receive tail after reading the data between old_tail and tail.
+// In DMA mode, the DMA may overwrite unread data, either before or while it
+// was copied, and then rx_dma_update() moves the tail past it.  Returns false
+// if that happened, so the caller discards its copy and reads again.
+inline bool HardwareSerialIMXRT::rx_tail_update(uint32_t old_tail, uint32_t tail)
+{
+	if (!rx_dma_) {
+		rx_buffer_tail_ = tail;
+		return true;
+	}
+	__disable_irq();
+	rx_dma_update();
+	if (rx_buffer_tail_ != old_tail) {
+		__enable_irq();
+		return false;
+	}
+	rx_buffer_tail_ = tail;
+	__enable_irq();
+	return true;
+}
+
 
 void HardwareSerialIMXRT::end(void)
 {
 	IMXRT_LPUART_t *port = (IMXRT_LPUART_t *)port_addr;
 	if (!(hardware->ccm_register & hardware->ccm_value)) return;
 	while (transmitting_) yield();  // wait for buffered data to send
+	if (rx_dma_ || tx_dma_) dma_stop();
 	port->CTRL = 0;	// disable the TX and RX ...
 
 	// Not sure if this is best, but I think most IO pins default to Mode 5? which appears to be digital IO? 
@@ -417,7 +453,15 @@ bool HardwareSerialIMXRT::attachCts(uint8_t pin)
 void HardwareSerialIMXRT::clear(void)
 {
 	// BUGBUG:: deal with FIFO
-	rx_buffer_head_ = rx_buffer_tail_;
+	if (rx_dma_) {
+		// the DMA owns the head, so discard by moving the tail
+		__disable_irq();
+		rx_dma_update();
+		rx_buffer_tail_ = rx_buffer_head_;
+		__enable_irq();
+	} else {
+		rx_buffer_head_ = rx_buffer_tail_;
+	}
 	if (rts_pin_baseReg_) rts_assert();
 }
 
@@ -441,12 +485,13 @@ int HardwareSerialIMXRT::available(void)
 
 	// WATER> 0 so IDLE involved may want to check if port has already has RX data to retrieve
 	__disable_irq();
+	if (rx_dma_) rx_dma_update();
 	head = rx_buffer_head_;
 	tail = rx_buffer_tail_;
 	int avail;
 	if (head >= tail) avail = head - tail;
 	else avail = rx_buffer_total_size_ + head - tail;	
-	avail += (port->WATER >> 24) & 0x7;
+	if (!rx_dma_) avail += (port->WATER >> 24) & 0x7;
 	__enable_irq();
 	return avail;
 }
@@ -465,6 +510,7 @@ void HardwareSerialIMXRT::addMemoryForRead(void *buffer, size_t length)
 	rx_buffer_tail_ = 0;
 	rts_low_watermark_ = rx_buffer_total_size_ - hardware->rts_low_watermark;
 	rts_high_watermark_ = rx_buffer_total_size_ - hardware->rts_high_watermark;
+	if (rx_dma_ && (hardware->ccm_register & hardware->ccm_value)) rx_dma_begin();
 }
 
 void HardwareSerialIMXRT::addMemoryForWrite(void *buffer, size_t length)
@@ -485,6 +531,7 @@ int HardwareSerialIMXRT::peek(void)
 	IMXRT_LPUART_t *port = (IMXRT_LPUART_t *)port_addr;
 	uint32_t head, tail;
 
+	rx_dma_poll();
 	head = rx_buffer_head_;
 	tail = rx_buffer_tail_;
 	if (head == tail) {
@@ -493,7 +540,7 @@ int HardwareSerialIMXRT::peek(void)
 		if (head == tail) {
 			// Still empty Now check for stuff in FIFO Queue.
 			int c = -1;	// assume nothing to return
-			if (port->WATER & 0x7000000) {
+			if (!rx_dma_ && (port->WATER & 0x7000000)) {
 				c = port->DATA & 0x3ff;		// Use only up to 10 bits of data
 				// But we don't want to throw it away...
 				// since queue is empty, just going to reset to front of queue...
@@ -518,33 +565,76 @@ int HardwareSerialIMXRT::peek(void)
 int HardwareSerialIMXRT::read(void)
 {
 	IMXRT_LPUART_t *port = (IMXRT_LPUART_t *)port_addr;
-	uint32_t head, tail;
+	uint32_t head, tail, old_tail;
 	int c;
 
-	head = rx_buffer_head_;
-	tail = rx_buffer_tail_;
-	if (head == tail) {
-		__disable_irq();
-		head = rx_buffer_head_;  // reread head to make sure no ISR happened
+	rx_dma_poll();
+	do {
+		head = rx_buffer_head_;
+		tail = rx_buffer_tail_;
 		if (head == tail) {
-			// Still empty Now check for stuff in FIFO Queue.
-			c = -1;	// assume nothing to return
-			if (port->WATER & 0x7000000) {
-				c = port->DATA & 0x3ff;		// Use only up to 10 bits of data
+			__disable_irq();
+			head = rx_buffer_head_;  // reread head to make sure no ISR happened
+			if (head == tail) {
+				// Still empty Now check for stuff in FIFO Queue.
+				c = -1;	// assume nothing to return
+				if (!rx_dma_ && (port->WATER & 0x7000000)) {
+					c = port->DATA & 0x3ff;		// Use only up to 10 bits of data
+				}
+				__enable_irq();
+				return c;
 			}
 			__enable_irq();
-			return c;
+
 		}
-		__enable_irq();
+		old_tail = tail;
+		if (++tail >= rx_buffer_total_size_) tail = 0;
+		if (tail < rx_buffer_size_) {
+			c = rx_buffer_[tail];
+		} else {
+			c = rx_buffer_storage_[tail-rx_buffer_size_];
+		}
+	} while (!rx_tail_update(old_tail, tail));
+	if (rts_pin_baseReg_) {
+		uint32_t avail;
+		if (head >= tail) avail = head - tail;
+		else avail = rx_buffer_total_size_ + head - tail;
 
+		if (avail <= rts_low_watermark_) rts_assert();
 	}
-	if (++tail >= rx_buffer_total_size_) tail = 0;
-	if (tail < rx_buffer_size_) {
-		c = rx_buffer_[tail];
-	} else {
-		c = rx_buffer_storage_[tail-rx_buffer_size_];
+	return c;
+}	
+
+// Copy already received data from the receive buffer, in contiguous runs
+size_t HardwareSerialIMXRT::read_buffered(char *buffer, size_t length)
+{
+	uint32_t head, tail, old_tail, pos, end, run;
+	size_t count;
+
+	rx_dma_poll();
+retry:
+	count = 0;
+	head = rx_buffer_head_;
+	tail = old_tail = rx_buffer_tail_;
+	while (count < length && head != tail) {
+		pos = tail + 1;
+		if (pos >= rx_buffer_total_size_) pos = 0;
+		end = (pos < rx_buffer_size_) ? rx_buffer_size_ : rx_buffer_total_size_;
+		if (head >= pos && head < end) end = head + 1;
+		run = end - pos;
+		if (run > length - count) run = length - count;
+		volatile BUFTYPE *p = (pos < rx_buffer_size_) ?
+			rx_buffer_ + pos : rx_buffer_storage_ + (pos - rx_buffer_size_);
+#ifdef SERIAL_9BIT_SUPPORT
+		for (uint32_t i=0; i < run; i++) buffer[count + i] = p[i];
+#else
+		memcpy(buffer + count, (const void *)p, run);
+#endif
+		count += run;
+		tail = pos + run - 1;
 	}
-	rx_buffer_tail_ = tail;
+	if (count == 0) return 0;
+	if (!rx_tail_update(old_tail, tail)) goto retry;
 	if (rts_pin_baseReg_) {
 		uint32_t avail;
 		if (head >= tail) avail = head - tail;
@@ -552,8 +642,38 @@ int HardwareSerialIMXRT::read(void)
 
 		if (avail <= rts_low_watermark_) rts_assert();
 	}
-	return c;
-}	
+	return count;
+}
+
+size_t HardwareSerialIMXRT::readBytes(char *buffer, size_t length)
+{
+	size_t count = 0;
+	unsigned long startMillis;
+
+	if (buffer == nullptr) return 0;
+	startMillis = millis();
+	while (count < length) {
+		size_t n = read_buffered(buffer + count, length - count);
+		if (n == 0) {
+			// nothing buffered, read() also fetches data still in the FIFO
+			int c = read();
+			if (c >= 0) {
+				buffer[count] = (char)c;
+				n = 1;
+			}
+		}
+		if (n > 0) {
+			count += n;
+			startMillis = millis();
+		} else if (millis() - startMillis < _timeout) {
+			yield();
+		} else {
+			setReadError();
+			break;
+		}
+	}
+	return count;
+}
 
 void HardwareSerialIMXRT::flush(void)
 {
@@ -566,12 +686,11 @@ size_t HardwareSerialIMXRT::write(uint8_t c)
 	return write9bit(c);
 }
 
-size_t HardwareSerialIMXRT::write9bit(uint32_t c)
+// Turn on the transmitter enable pin or half duplex transmit direction
+inline void HardwareSerialIMXRT::transmit_begin()
 {
 	IMXRT_LPUART_t *port = (IMXRT_LPUART_t *)port_addr;
-	uint32_t head, n;
-	//digitalWrite(3, HIGH);
-	//digitalWrite(5, HIGH);
+
 	if (transmit_pin_baseReg_) DIRECT_WRITE_HIGH(transmit_pin_baseReg_, transmit_pin_bitmask_);
 	if(half_duplex_mode_) {		
 		__disable_irq();
@@ -579,27 +698,92 @@ size_t HardwareSerialIMXRT::write9bit(uint32_t c)
 		__enable_irq();
 		//digitalWriteFast(2, HIGH);
 	}
+}
+
+// Called while the transmit buffer is full.  If our interrupt can't run
+// at the current priority, move 1 byte to the hardware ourselves.
+inline void HardwareSerialIMXRT::transmit_wait()
+{
+	IMXRT_LPUART_t *port = (IMXRT_LPUART_t *)port_addr;
+	uint32_t n;
+
+	int priority = nvic_execution_priority();
+	if (priority <= hardware->irq_priority) {
+		if (tx_dma_) {
+			if (tx_dma_->complete()) tx_dma_complete();
+		} else if ((port->STAT & LPUART_STAT_TDRE)) {
+			uint32_t tail = tx_buffer_tail_;
+			if (++tail >= tx_buffer_total_size_) tail = 0;
+			if (tail < tx_buffer_size_) {
+				n = tx_buffer_[tail];
+			} else {
+				n = tx_buffer_storage_[tail-tx_buffer_size_];
+			}
+			port->DATA  = n;
+			tx_buffer_tail_ = tail;
+		}
+	} else if (priority >= 256) 
+	{
+		yield(); // wait
+	} 
+}
+
+size_t HardwareSerialIMXRT::write(const uint8_t *buffer, size_t size)
+{
+	IMXRT_LPUART_t *port = (IMXRT_LPUART_t *)port_addr;
+	uint32_t head, tail, pos, end, avail, run;
+	size_t count = size;
+
+	if (size == 0) return 0;
+	transmit_begin();
+	while (count > 0) {
+		head = tx_buffer_head_;
+		tail = tx_buffer_tail_;
+		if (head >= tail) avail = tx_buffer_total_size_ - 1 - head + tail;
+		else avail = tail - head - 1;
+		if (avail == 0) {
+			transmit_wait();
+			continue;
+		}
+		// copy as much as fits before the end of the buffer or
+		// the end of the memory added with addMemoryForWrite
+		pos = head + 1;
+		if (pos >= tx_buffer_total_size_) pos = 0;
+		end = (pos < tx_buffer_size_) ? tx_buffer_size_ : tx_buffer_total_size_;
+		run = end - pos;
+		if (run > avail) run = avail;
+		if (run > count) run = count;
+		volatile BUFTYPE *p = (pos < tx_buffer_size_) ?
+			tx_buffer_ + pos : tx_buffer_storage_ + (pos - tx_buffer_size_);
+#ifdef SERIAL_9BIT_SUPPORT
+		for (uint32_t i=0; i < run; i++) p[i] = buffer[i];
+#else
+		memcpy((void *)p, buffer, run);
+#endif
+		buffer += run;
+		count -= run;
+		__disable_irq();
+		transmitting_ = 1;
+		tx_buffer_head_ = pos + run - 1;
+		if (tx_dma_) tx_dma_start();
+		else port->CTRL |= LPUART_CTRL_TIE;
+		__enable_irq();
+	}
+	return size;
+}
+
+size_t HardwareSerialIMXRT::write9bit(uint32_t c)
+{
+	IMXRT_LPUART_t *port = (IMXRT_LPUART_t *)port_addr;
+	uint32_t head;
+	//digitalWrite(3, HIGH);
+	//digitalWrite(5, HIGH);
+	transmit_begin();
 
 	head = tx_buffer_head_;
 	if (++head >= tx_buffer_total_size_) head = 0;
 	while (tx_buffer_tail_ == head) {
-		int priority = nvic_execution_priority();
-		if (priority <= hardware->irq_priority) {
-			if ((port->STAT & LPUART_STAT_TDRE)) {
-				uint32_t tail = tx_buffer_tail_;
-				if (++tail >= tx_buffer_total_size_) tail = 0;
-				if (tail < tx_buffer_size_) {
-					n = tx_buffer_[tail];
-				} else {
-					n = tx_buffer_storage_[tail-tx_buffer_size_];
-				}
-				port->DATA  = n;
-				tx_buffer_tail_ = tail;
-			}
-		} else if (priority >= 256) 
-		{
-			yield(); // wait
-		} 
+		transmit_wait();
 	}
 	//digitalWrite(5, LOW);
 	//Serial.printf("WR %x %d %d %d %x %x\n", c, head, tx_buffer_size_,  tx_buffer_total_size_, (uint32_t)tx_buffer_, (uint32_t)tx_buffer_storage_);
@@ -611,7 +795,8 @@ size_t HardwareSerialIMXRT::write9bit(uint32_t c)
 	__disable_irq();
 	transmitting_ = 1;
 	tx_buffer_head_ = head;
-	port->CTRL |= LPUART_CTRL_TIE; // (may need to handle this issue)BITBAND_SET_BIT(LPUART0_CTRL, TIE_BIT);
+	if (tx_dma_) tx_dma_start();
+	else port->CTRL |= LPUART_CTRL_TIE; // (may need to handle this issue)BITBAND_SET_BIT(LPUART0_CTRL, TIE_BIT);
 	__enable_irq();
 	//digitalWrite(3, LOW);
 	return 1;
@@ -624,9 +809,36 @@ void HardwareSerialIMXRT::IRQHandler()
 	uint32_t head, tail, n;
 	uint32_t ctrl;
 
-	// See if we have stuff to read in.
-	// Todo - Check idle. 
-	if (port->STAT & (LPUART_STAT_RDRF | LPUART_STAT_IDLE)) {
+	// This handler is also attached to the DMA channels
+	if (rx_dma_ && (DMA_INT & (1 << rx_dma_->channel))) {
+		rx_dma_->clearInterrupt();
+		if (rx_buffer_storage_ && rx_dma_->complete()) {
+			// continue in the other part of the buffer
+			rx_dma_->clearComplete();
+			if (rx_dma_->TCD->DADDR == (void *)(rx_buffer_ + rx_buffer_size_)) {
+				rx_dma_->TCD->DADDR = rx_buffer_storage_;
+				rx_dma_->transferCount(rx_buffer_total_size_ - rx_buffer_size_);
+			} else {
+				rx_dma_->TCD->DADDR = rx_buffer_;
+				rx_dma_->transferCount(rx_buffer_size_);
+			}
+			rx_dma_->enable();
+		}
+		rx_dma_update();
+	}
+	if (tx_dma_ && tx_dma_count_ && tx_dma_->complete()) {
+		tx_dma_complete();
+	}
+
+	if (rx_dma_) {
+		// The DMA takes the data, idle only tells us a burst has ended
+		if (port->STAT & LPUART_STAT_IDLE) {
+			port->STAT |= LPUART_STAT_IDLE;
+			rx_dma_update();
+		}
+	} else if (port->STAT & (LPUART_STAT_RDRF | LPUART_STAT_IDLE)) {
+		// See if we have stuff to read in.
+		// Todo - Check idle. 
 		// See how many bytes or pending. 
 		//digitalWrite(5, HIGH);
 		uint8_t avail = (port->WATER >> 24) & 0x7;
@@ -707,6 +919,238 @@ void HardwareSerialIMXRT::IRQHandler()
 	//digitalWrite(4, LOW);
 }
 
+// DMAMUX request sources for each LPUART
+static uint8_t lpuart_dma_source(uintptr_t port_addr, bool tx)
+{
+	switch (port_addr) {
+	  case IMXRT_LPUART1_ADDRESS: return tx ? DMAMUX_SOURCE_LPUART1_TX : DMAMUX_SOURCE_LPUART1_RX;
+	  case IMXRT_LPUART2_ADDRESS: return tx ? DMAMUX_SOURCE_LPUART2_TX : DMAMUX_SOURCE_LPUART2_RX;
+	  case IMXRT_LPUART3_ADDRESS: return tx ? DMAMUX_SOURCE_LPUART3_TX : DMAMUX_SOURCE_LPUART3_RX;
+	  case IMXRT_LPUART4_ADDRESS: return tx ? DMAMUX_SOURCE_LPUART4_TX : DMAMUX_SOURCE_LPUART4_RX;
+	  case IMXRT_LPUART5_ADDRESS: return tx ? DMAMUX_SOURCE_LPUART5_TX : DMAMUX_SOURCE_LPUART5_RX;
+	  case IMXRT_LPUART6_ADDRESS: return tx ? DMAMUX_SOURCE_LPUART6_TX : DMAMUX_SOURCE_LPUART6_RX;
+	  case IMXRT_LPUART7_ADDRESS: return tx ? DMAMUX_SOURCE_LPUART7_TX : DMAMUX_SOURCE_LPUART7_RX;
+	  default:                    return tx ? DMAMUX_SOURCE_LPUART8_TX : DMAMUX_SOURCE_LPUART8_RX;
+	}
+}
+
+// Buffers in DTCM are not cached.  Buffers in OCRAM (DMAMEM) are, which is
+// why they must be 32 byte aligned for DMA.
+static inline bool dma_buffer_cached(volatile const void *p)
+{
+	return (uint32_t)p >= 0x20200000;
+}
+
+bool HardwareSerialIMXRT::useDMA(bool receive, bool transmit)
+{
+	bool ok = true;
+#ifdef SERIAL_9BIT_SUPPORT
+	// DMA moves 8 bit bytes, without the 9th bit
+	if (receive || transmit) return false;
+#endif
+	bool active = (hardware->ccm_register & hardware->ccm_value) != 0;
+	if (active) {
+		while (transmitting_) yield();  // wait for buffered data to send
+		dma_stop();
+	}
+	if (receive && !rx_dma_) {
+		rx_dma_ = new DMAChannel();
+		if (!rx_dma_->TCD) {
+			delete rx_dma_;
+			rx_dma_ = nullptr;
+			ok = false;
+		}
+	} else if (!receive && rx_dma_) {
+		delete rx_dma_;
+		rx_dma_ = nullptr;
+	}
+	if (transmit && !tx_dma_) {
+		tx_dma_ = new DMAChannel();
+		if (!tx_dma_->TCD) {
+			delete tx_dma_;
+			tx_dma_ = nullptr;
+			ok = false;
+		}
+	} else if (!transmit && tx_dma_) {
+		delete tx_dma_;
+		tx_dma_ = nullptr;
+	}
+	if (active) {
+		if (rx_dma_) rx_dma_begin();
+		if (tx_dma_) tx_dma_begin();
+	}
+	return ok;
+}
+
+// Start receiving with DMA.  A buffer without added memory is filled as a
+// circle with no CPU involvement.  With memory from addMemoryForRead, the
+// DMA stops at the end of each part and our interrupt starts the other,
+// while the LPUART FIFO holds up to 4 incoming bytes.
+void HardwareSerialIMXRT::rx_dma_begin()
+{
+	IMXRT_LPUART_t *port = (IMXRT_LPUART_t *)port_addr;
+
+	rx_dma_->disable();
+	port->BAUD &= ~LPUART_BAUD_RDMAE;
+	// DMA writes the next byte at index 0
+	rx_buffer_head_ = rx_buffer_total_size_ - 1;
+	rx_buffer_tail_ = rx_buffer_total_size_ - 1;
+	rx_dma_->source(*(volatile uint8_t *)&port->DATA);
+	rx_dma_->destinationBuffer((volatile uint8_t *)rx_buffer_, rx_buffer_size_);
+	rx_dma_->TCD->CSR = 0;
+	if (rx_buffer_storage_) {
+		rx_dma_->TCD->DLASTSGA = 0;
+		rx_dma_->disableOnCompletion();
+	}
+	// half and complete interrupts keep RTS current during long transfers
+	rx_dma_->interruptAtHalf();
+	rx_dma_->interruptAtCompletion();
+	rx_dma_->triggerAtHardwareEvent(lpuart_dma_source(port_addr, false));
+	rx_dma_->attachInterrupt(hardware->irq_handler, hardware->irq_priority);
+	rx_dma_->clearComplete();
+	rx_dma_->enable();
+
+	// request DMA for every byte, leave only the idle interrupt
+	port->WATER &= ~LPUART_WATER_RXWATER(3);
+	__disable_irq();
+	port->CTRL &= ~LPUART_CTRL_RIE;
+	__enable_irq();
+	port->BAUD |= LPUART_BAUD_RDMAE;
+	if (rts_pin_baseReg_) rts_assert();
+}
+
+void HardwareSerialIMXRT::tx_dma_begin()
+{
+	IMXRT_LPUART_t *port = (IMXRT_LPUART_t *)port_addr;
+
+	tx_dma_->disable();
+	tx_dma_count_ = 0;
+	tx_dma_->destination(*(volatile uint8_t *)&port->DATA);
+	tx_dma_->TCD->CSR = 0;
+	tx_dma_->disableOnCompletion();
+	tx_dma_->interruptAtCompletion();
+	tx_dma_->triggerAtHardwareEvent(lpuart_dma_source(port_addr, true));
+	tx_dma_->attachInterrupt(hardware->irq_handler, hardware->irq_priority);
+	port->BAUD |= LPUART_BAUD_TDMAE;
+	__disable_irq();
+	tx_dma_start();
+	__enable_irq();
+}
+
+// Stop DMA and return to interrupt driven operation
+void HardwareSerialIMXRT::dma_stop()
+{
+	IMXRT_LPUART_t *port = (IMXRT_LPUART_t *)port_addr;
+
+	port->BAUD &= ~(LPUART_BAUD_RDMAE | LPUART_BAUD_TDMAE);
+	if (rx_dma_) {
+		rx_dma_->disable();
+		rx_dma_->clearInterrupt();
+		port->WATER |= LPUART_WATER_RXWATER(2);
+		__disable_irq();
+		port->CTRL |= LPUART_CTRL_RIE;
+		__enable_irq();
+	}
+	if (tx_dma_) {
+		tx_dma_->disable();
+		tx_dma_->clearInterrupt();
+		tx_dma_count_ = 0;
+	}
+}
+
+// Compute the receive head from the DMA destination address.  Must be
+// called with interrupts disabled, or from our interrupt.
+void HardwareSerialIMXRT::rx_dma_update()
+{
+	volatile BUFTYPE *next = (volatile BUFTYPE *)rx_dma_->TCD->DADDR;
+	uint32_t head, pos, end;
+
+	if (next >= rx_buffer_ && next <= rx_buffer_ + rx_buffer_size_) {
+		head = next - rx_buffer_;
+	} else {
+		head = rx_buffer_size_ + (next - rx_buffer_storage_);
+	}
+	// head is the last byte written, one before the DMA destination
+	head = (head > 0) ? head - 1 : rx_buffer_total_size_ - 1;
+	pos = rx_buffer_head_;
+	if (head == pos) return;
+
+	// The DMA doesn't stop when the buffer is full.  If it wrapped past
+	// the tail, the oldest unread data was overwritten, so skip ahead and
+	// keep only the newest.  The half and complete interrupts run this
+	// often enough that less than a whole buffer arrives in between.
+	// Readers see the tail move in rx_tail_update() and read again.
+	uint32_t tail = rx_buffer_tail_;
+	uint32_t received = (head >= pos) ? head - pos : rx_buffer_total_size_ + head - pos;
+	uint32_t space = (tail > pos) ? tail - pos - 1 : rx_buffer_total_size_ + tail - pos - 1;
+	if (received > space) {
+		tail = head + 1;
+		if (tail >= rx_buffer_total_size_) tail = 0;
+		rx_buffer_tail_ = tail;
+	}
+
+	// discard stale cache lines over the newly received data
+	while (pos != head) {
+		if (++pos >= rx_buffer_total_size_) pos = 0;
+		end = (pos < rx_buffer_size_) ? rx_buffer_size_ : rx_buffer_total_size_;
+		if (head >= pos && head < end) end = head + 1;
+		volatile BUFTYPE *p = (pos < rx_buffer_size_) ?
+			rx_buffer_ + pos : rx_buffer_storage_ + (pos - rx_buffer_size_);
+		if (dma_buffer_cached(p)) arm_dcache_delete((void *)p, (end - pos) * sizeof(BUFTYPE));
+		pos = end - 1;
+	}
+	rx_buffer_head_ = head;
+	if (rts_pin_baseReg_) {
+		uint32_t avail;
+		if (head >= tail) avail = head - tail;
+		else avail = rx_buffer_total_size_ + head - tail;
+		if (avail >= rts_high_watermark_) rts_deassert();
+	}
+}
+
+// Start a DMA transfer of the next contiguous run in the transmit buffer.
+// Must be called with interrupts disabled, or from our interrupt.
+void HardwareSerialIMXRT::tx_dma_start()
+{
+	IMXRT_LPUART_t *port = (IMXRT_LPUART_t *)port_addr;
+	uint32_t head, tail, pos, end, run;
+
+	if (tx_dma_count_) return;
+	head = tx_buffer_head_;
+	tail = tx_buffer_tail_;
+	if (head == tail) return;
+	pos = tail + 1;
+	if (pos >= tx_buffer_total_size_) pos = 0;
+	end = (pos < tx_buffer_size_) ? tx_buffer_size_ : tx_buffer_total_size_;
+	if (head >= pos && head < end) end = head + 1;
+	run = end - pos;
+	volatile BUFTYPE *p = (pos < tx_buffer_size_) ?
+		tx_buffer_ + pos : tx_buffer_storage_ + (pos - tx_buffer_size_);
+	if (dma_buffer_cached(p)) arm_dcache_flush((void *)p, run * sizeof(BUFTYPE));
+	port->CTRL &= ~LPUART_CTRL_TCIE;
+	tx_dma_->sourceBuffer((volatile const uint8_t *)p, run);
+	tx_dma_->clearComplete();
+	tx_dma_count_ = run;
+	tx_dma_->enable();
+}
+
+// A transmit DMA run finished.  Free its space and send the next run,
+// or wait for the last byte to leave the shift register.
+void HardwareSerialIMXRT::tx_dma_complete()
+{
+	IMXRT_LPUART_t *port = (IMXRT_LPUART_t *)port_addr;
+	uint32_t tail;
+
+	tx_dma_->clearInterrupt();
+	tx_dma_->clearComplete();
+	tail = tx_buffer_tail_ + tx_dma_count_;
+	if (tail >= tx_buffer_total_size_) tail -= tx_buffer_total_size_;
+	tx_buffer_tail_ = tail;
+	tx_dma_count_ = 0;
+	tx_dma_start();
+	if (!tx_dma_count_) port->CTRL |= LPUART_CTRL_TCIE;
+}
+
 
 void HardwareSerialIMXRT::addToSerialEventsList() {
 	for (uint8_t i = 0; i < s_count_serials_with_serial_events; i++) {
@@ -150,6 +150,7 @@ typedef struct _pin_to_xbar_info{
 extern const pin_to_xbar_info_t pin_to_xbar_info[];
 extern const uint8_t count_pin_to_xbar_info;
 
+class DMAChannel;
 
 // HardwareSerial is now an abstract class, intended to allow FlexIO and USB Host
 // serial devices to be compatible with libraries like MIDI, OSC, Adafruit_GPS
@@ -220,8 +221,17 @@ public:
 	virtual void flush(void);
 	// Transmit a single byte
 	virtual size_t write(uint8_t c);
+	// Transmit a block of data.  Contiguous runs are copied into the transmit
+	// buffer at once, waiting only if the buffer becomes full.
+	virtual size_t write(const uint8_t *buffer, size_t size);
 	// Reads the next received byte, or returns -1 if nothing has been received.
 	virtual int read(void);
+	// Read up to length bytes into a buffer.  readBytes() copies everything
+	// already received at once, then waits for more data up to the number of
+	// milliseconds configured by setTimeout().  The return value is the
+	// number of bytes actually read.
+	virtual size_t readBytes(char *buffer, size_t length);
+	size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
 	// Configures a digital pin to be HIGH while transmitting.  Typically this
 	// pin is used to control the DE and RE' pins of an 8 pin RS485 transceiver
 	// chip, which transmits when DE is high and receives when RE' is low.
@@ -262,6 +272,16 @@ public:
 	// to print or write a large amount of data, without waiting.  The buffer
 	// array must be a global or static variable.
 	void addMemoryForWrite(void *buffer, size_t length);
+	// Move received and transmitted data with DMA, rather than an interrupt
+	// every few bytes.  Received data is visible to available() and read() as
+	// soon as DMA stores it.  Call before begin(), or while no data is being
+	// transferred, because buffered data is discarded.  Returns false if no
+	// DMA channel is free.  Buffers in DMAMEM given to addMemoryForRead() or
+	// addMemoryForWrite() must be 32 byte aligned and a multiple of 32 bytes
+	// in size, because receiving discards their cache lines.  Without RTS
+	// flow control, data arriving faster than it is read overwrites the
+	// oldest unread data, and read() continues with the newest data.
+	bool useDMA(bool receive=true, bool transmit=true);
 	void addStorageForRead(void *buffer, size_t length) __attribute__((deprecated("addStorageForRead was renamed to addMemoryForRead"))){
 		addMemoryForRead(buffer, length);
 	}
@@ -321,6 +341,9 @@ private:
 	volatile uint16_t 	tx_buffer_tail_ = 0;
 	volatile uint16_t 	rx_buffer_head_ = 0;
 	volatile uint16_t 	rx_buffer_tail_ = 0;
+	DMAChannel			*rx_dma_ = nullptr;
+	DMAChannel			*tx_dma_ = nullptr;
+	volatile uint16_t	tx_dma_count_ = 0;	// bytes in the running transmit DMA
 
 	volatile uint32_t 	*transmit_pin_baseReg_ = 0;
 	uint32_t 			transmit_pin_bitmask_ = 0;
@@ -330,6 +353,17 @@ private:
 
   	inline void rts_assert();
   	inline void rts_deassert();
+	inline void transmit_begin();
+	inline void transmit_wait();
+	size_t read_buffered(char *buffer, size_t length);
+	void rx_dma_begin();
+	void tx_dma_begin();
+	void dma_stop();
+	void rx_dma_update();
+	inline void rx_dma_poll();
+	inline bool rx_tail_update(uint32_t old_tail, uint32_t tail);
+	void tx_dma_start();
+	void tx_dma_complete();
 
 	void IRQHandler();
 	friend void IRQHandler_Serial1();
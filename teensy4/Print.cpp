@@ -92,8 +92,8 @@ extern "C" {
 __attribute__((weak))
 int _write(int file, char *ptr, int len)
 {
-	if (file >= 0 && file <= 2) file = (int)&Serial;
-	return ((class Print *)file)->write((uint8_t *)ptr, len);
+	if (file >= 0 && file <= 2) file = (int)(intptr_t)&Serial;
+	return ((class Print *)(intptr_t)file)->write((uint8_t *)ptr, len);
 }
 }
 
@@ -105,7 +105,7 @@ int Print::printf(const char *format, ...)
 	va_end(ap);
 	return 0;  // TODO: make this work with -std=c++0x
 #else
-	int retval = vdprintf((int)this, format, ap);
+	int retval = vdprintf((int)(intptr_t)this, format, ap);
 	va_end(ap);
 	return retval;
 #endif
@@ -119,118 +119,323 @@ int Print::printf(const __FlashStringHelper *format, ...)
 	va_end(ap);
 	return 0;
 #else
-	int retval = vdprintf((int)this, (const char *)format, ap);
+	int retval = vdprintf((int)(intptr_t)this, (const char *)format, ap);
 	va_end(ap);
 	return retval;
 #endif
 }
 
-size_t Print::printNumber(unsigned long n, uint8_t base, uint8_t sign)
-{
-	uint8_t buf[34];
-	uint8_t digit, i;
+// Every value 0 to 99 as 2 ASCII digits.  Decimal conversion uses
+// one division by 100 for each pair of digits.  Because the divisor is
+// a constant, the compiler turns it into a multiply by the reciprocal.
+static const char digit_pairs[201] =
+	"00010203040506070809101112131415161718192021222324"
+	"25262728293031323334353637383940414243444546474849"
+	"50515253545556575859606162636465666768697071727374"
+	"75767778798081828384858687888990919293949596979899";
 
-	// TODO: make these checks as inline, since base is
-	// almost always a constant.  base = 0 (BYTE) should
-	// inline as a call directly to write()
-	if (base == 0) {
-		return write((uint8_t)n);
-	} else if (base == 1) {
-		base = 10;
+// Write the decimal digits of n, ending just before end.  Returns a
+// pointer to the first digit.
+static uint8_t * format_dec(uint32_t n, uint8_t *end)
+{
+	while (n >= 100) {
+		uint32_t q = n / 100;
+		const char *d = digit_pairs + (n - q * 100) * 2;
+		*--end = d[1];
+		*--end = d[0];
+		n = q;
+	}
+	if (n >= 10) {
+		*--end = digit_pairs[n * 2 + 1];
+		*--end = digit_pairs[n * 2];
+	} else {
+		*--end = '0' + n;
 	}
+	return end;
+}
 
+// Write exactly 9 decimal digits, with leading zeros, for the lower
+// parts of a 64 bit number.
+static uint8_t * format_dec9(uint32_t n, uint8_t *end)
+{
+	for (int i=0; i < 4; i++) {
+		uint32_t q = n / 100;
+		const char *d = digit_pairs + (n - q * 100) * 2;
+		*--end = d[1];
+		*--end = d[0];
+		n = q;
+	}
+	*--end = '0' + n;
+	return end;
+}
 
-	if (n == 0) {
-		buf[sizeof(buf) - 1] = '0';
-		i = sizeof(buf) - 1;
-	} else {
-		i = sizeof(buf) - 1;
-		while (1) {
-			digit = n % base;
-			buf[i] = ((digit < 10) ? '0' + digit : 'A' + digit - 10);
-			n /= base;
-			if (n == 0) break;
-			i--;
-		}
+// Peel off 9 digits at a time, so only the upper parts of large
+// numbers need 64 bit division.
+static uint8_t * format_dec64(uint64_t n, uint8_t *end)
+{
+	while (n > 0xFFFFFFFF) {
+		uint64_t q = n / 1000000000;
+		end = format_dec9(n - q * 1000000000, end);
+		n = q;
 	}
-	if (sign) {
-		i--;
-		buf[i] = '-';
+	return format_dec(n, end);
+}
+
+// Bases 2, 4, 8, 16 and 32 need only shift and mask.
+template <typename T>
+static uint8_t * format_pow2(T n, uint8_t *end, uint8_t shift)
+{
+	const uint32_t mask = (1 << shift) - 1;
+	do {
+		uint8_t digit = (uint32_t)n & mask;
+		*--end = ((digit < 10) ? '0' + digit : 'A' + digit - 10);
+		n >>= shift;
+	} while (n);
+	return end;
+}
+
+template <typename T>
+static uint8_t * format_any(T n, uint8_t *end, uint8_t base)
+{
+	do {
+		uint8_t digit = n % base;
+		*--end = ((digit < 10) ? '0' + digit : 'A' + digit - 10);
+		n /= base;
+	} while (n);
+	return end;
+}
+
+size_t Print::printNumberDec(unsigned long n, uint8_t sign)
+{
+	uint8_t buf[11];
+	uint8_t *p = format_dec(n, buf + sizeof(buf));
+	if (sign) *--p = '-';
+	return write(p, buf + sizeof(buf) - p);
+}
+
+size_t Print::printNumberPow2(unsigned long n, uint8_t shift, uint8_t sign)
+{
+	uint8_t buf[33];
+	uint8_t *p = format_pow2(n, buf + sizeof(buf), shift);
+	if (sign) *--p = '-';
+	return write(p, buf + sizeof(buf) - p);
+}
+
+size_t Print::printNumberAny(unsigned long n, uint8_t base, uint8_t sign)
+{
+	uint8_t buf[34];
+	uint8_t *p;
+
+	if (base == 0) {
+		return write((uint8_t)n);
+	} else if (base == 1 || base == 10) {
+		return printNumberDec(n, sign);
+	} else if ((base & (base - 1)) == 0) {
+		return printNumberPow2(n, __builtin_ctz(base), sign);
 	}
-	return write(buf + i, sizeof(buf) - i);
+	p = format_any(n, buf + sizeof(buf), base);
+	if (sign) *--p = '-';
+	return write(p, buf + sizeof(buf) - p);
 }
 
 size_t Print::printNumber64(uint64_t n, uint8_t base, uint8_t sign)
 {
 	uint8_t buf[66];
-	uint8_t digit, i;
+	uint8_t *p = buf + sizeof(buf);
 
 	if (base < 2) return 0;
-	if (n == 0) {
-		buf[sizeof(buf) - 1] = '0';
-		i = sizeof(buf) - 1;
+	if (base == 10) {
+		p = format_dec64(n, p);
+	} else if ((base & (base - 1)) == 0) {
+		p = format_pow2(n, p, __builtin_ctz(base));
 	} else {
-		i = sizeof(buf) - 1;
-		while (1) {
-			digit = n % base;
-			buf[i] = ((digit < 10) ? '0' + digit : 'A' + digit - 10);
-			n /= base;
-			if (n == 0) break;
-			i--;
+		p = format_any(n, p, base);
+	}
+	if (sign) *--p = '-';
+	return write(p, buf + sizeof(buf) - p);
+}
+
+// Collects the output of format(), so it usually reaches write() as
+// one block instead of many small pieces.
+class PrintFormatBuffer {
+public:
+	PrintFormatBuffer(Print *p) : out(p) {}
+	void put(uint8_t c) {
+		if (len >= sizeof(buf)) flush();
+		buf[len++] = c;
+	}
+	void put(const uint8_t *s, size_t n) {
+		while (n--) put(*s++);
+	}
+	void fill(uint8_t c, int n) {
+		while (n-- > 0) put(c);
+	}
+	size_t flush() {
+		if (len > 0) {
+			count += out->write(buf, len);
+			len = 0;
 		}
+		return count;
+	}
+private:
+	Print *out;
+	size_t count = 0;
+	size_t len = 0;
+	uint8_t buf[128];
+};
+
+// Integer digits for format() types d, x, X, o and b.
+template <typename T>
+static uint8_t * format_int(T n, uint8_t *end, char type)
+{
+	uint8_t *p;
+
+	switch (type) {
+	case 'x':
+	case 'X':
+		p = format_pow2(n, end, 4);
+		break;
+	case 'o':
+		p = format_pow2(n, end, 3);
+		break;
+	case 'b':
+		p = format_pow2(n, end, 1);
+		break;
+	default:
+		return (sizeof(T) > 4) ? format_dec64(n, end) : format_dec(n, end);
 	}
-	if (sign) {
-		i--;
-		buf[i] = '-';
+	if (type == 'x') {
+		for (uint8_t *q = p; q < end; q++) {
+			if (*q >= 'A') *q += 'a' - 'A';
+		}
 	}
-	return write(buf + i, sizeof(buf) - i);
+	return p;
 }
 
-size_t Print::printFloat(double number, uint8_t digits) 
+static bool format_is_decimal(char type)
 {
-	uint8_t sign=0;
-	size_t count=0;
+	return type != 'x' && type != 'X' && type != 'o' && type != 'b';
+}
 
-	if (isnan(number)) return print("nan");
-    	if (isinf(number)) return print("inf");
-    	if (number > 4294967040.0f) return print("ovf");  // constant determined empirically
-    	if (number <-4294967040.0f) return print("ovf");  // constant determined empirically
-	
-	// Handle negative numbers
-	if (number < 0.0) {
-		sign = 1;
-		number = -number;
-	}
+size_t Print::vformat(const char *fmt, const FormatArg *args, unsigned int count)
+{
+	PrintFormatBuffer out(this);
+	unsigned int index = 0;
 
-	// Round correctly so that print(1.999, 2) prints as "2.00"
-	double rounding = 0.5;
-	for (uint8_t i=0; i<digits; ++i) {
-		rounding *= 0.1;
-	}
-	number += rounding;
-
-	// Extract the integer part of the number and print it
-	unsigned long int_part = (unsigned long)number;
-	double remainder = number - (double)int_part;
-	count += printNumber(int_part, 10, sign);
-
-	// Print the decimal point, but only if there are digits beyond
-	if (digits > 0) {
-		uint8_t n, buf[16], count=1;
-		buf[0] = '.';
-
-		// Extract digits from the remainder one at a time
-		if (digits > sizeof(buf) - 1) digits = sizeof(buf) - 1;
-
-		while (digits-- > 0) {
-			remainder *= 10.0;
-			n = (uint8_t)(remainder);
-			buf[count++] = '0' + n;
-			remainder -= n; 
+	while (*fmt) {
+		char c = *fmt++;
+		if (c != '{' || *fmt == '{') {
+			// literal text, with {{ and }} as single braces
+			if ((c == '{' || c == '}') && *fmt == c) fmt++;
+			out.put(c);
+			continue;
+		}
+		// parse {:[<|>][0][width][.precision][type]}
+		char align = 0, fill = ' ', type = 0;
+		int width = 0, precision = -1;
+		if (*fmt == ':') {
+			fmt++;
+			if (*fmt == '<' || *fmt == '>') align = *fmt++;
+			if (*fmt == '0') {
+				fill = '0';
+				fmt++;
+			}
+			while (*fmt >= '0' && *fmt <= '9') width = width * 10 + *fmt++ - '0';
+			if (*fmt == '.') {
+				fmt++;
+				precision = 0;
+				while (*fmt >= '0' && *fmt <= '9') precision = precision * 10 + *fmt++ - '0';
+			}
+			if (*fmt && *fmt != '}') type = *fmt++;
+		}
+		while (*fmt && *fmt != '}') fmt++;
+		if (*fmt) fmt++;
+		if (index >= count) continue;
+		const FormatArg &arg = args[index++];
+
+		uint8_t buf[66];
+		uint8_t *end = buf + sizeof(buf), *p = end;
+		bool numeric = true;
+		switch (arg.type) {
+		case FormatArg::CHAR:
+			if (type == 0 || type == 'c') {
+				*--p = arg.u;
+				numeric = false;
+			} else {
+				p = format_int(arg.u, end, type);
+			}
+			break;
+		case FormatArg::INT:
+			if (arg.i < 0 && format_is_decimal(type)) {
+				p = format_int(-(uint32_t)arg.i, end, type);
+				*--p = '-';
+			} else {
+				p = format_int((uint32_t)arg.i, end, type);
+			}
+			break;
+		case FormatArg::UINT:
+			p = format_int(arg.u, end, type);
+			break;
+		case FormatArg::INT64:
+			if (arg.i64 < 0 && format_is_decimal(type)) {
+				p = format_int(-(uint64_t)arg.i64, end, type);
+				*--p = '-';
+			} else {
+				p = format_int((uint64_t)arg.i64, end, type);
+			}
+			break;
+		case FormatArg::UINT64:
+			p = format_int(arg.u64, end, type);
+			break;
+		case FormatArg::DOUBLE: {
+			int len = dtoa_fixed(arg.d, (precision < 0) ? 2 : precision, (char *)buf);
+			if (len == 0) {
+				len = 3;
+				memcpy(buf, isnan(arg.d) ? "nan" : (isinf(arg.d) ? "inf" : "ovf"), 3);
+			}
+			p = buf;
+			end = buf + len;
+			} break;
+		case FormatArg::STRING:
+			p = (uint8_t *)(arg.s ? arg.s : "");
+			end = p + strlen((const char *)p);
+			if (precision >= 0 && end - p > precision) end = p + precision;
+			numeric = false;
+			break;
+		case FormatArg::POINTER:
+			p = format_int(arg.u, end, type ? type : 'x');
+			*--p = 'x';
+			*--p = '0';
+			break;
+		default:
+			break;
 		}
-		count += write(buf, count);
+		// pad to width, numbers to the right and text to the left
+		int pad = width - (end - p);
+		if (align == 0) align = numeric ? '>' : '<';
+		if (pad > 0 && align == '>') {
+			if (fill == '0' && numeric) {
+				if (*p == '-') out.put(*p++);
+				out.fill('0', pad);
+			} else {
+				out.fill(' ', pad);
+			}
+		}
+		out.put(p, end - p);
+		if (pad > 0 && align == '<') out.fill(' ', pad);
 	}
-	return count;
+	return out.flush();
+}
+
+size_t Print::printFloat(double number, uint8_t digits) 
+{
+	char buf[40];
+
+	if (isnan(number)) return print("nan");
+	if (isinf(number)) return print("inf");
+	int len = dtoa_fixed(number, digits, buf);
+	if (len == 0) return print("ovf");
+	return write(buf, len);
 }
 
 
@@ -51,6 +51,37 @@
 
 class __FlashStringHelper;
 
+// A format string for Print::format(), written as "x={} y={:04X}"_fmt.
+// The _fmt suffix makes the text part of the type, so the number of {}
+// placeholders is checked against the arguments at compile time.
+template <char... C>
+struct PrintFormatString {
+	static constexpr char str[sizeof...(C) + 1] = {C..., 0};
+	// number of {} placeholders, or -1 if the braces are not balanced
+	static constexpr int count() {
+		int n = 0;
+		for (unsigned int i=0; i < sizeof...(C); i++) {
+			if (str[i] == '{') {
+				if (str[i+1] == '{') { i++; continue; }
+				while (str[i] != '}') {
+					if (str[i] == 0 || str[i+1] == '{') return -1;
+					i++;
+				}
+				n++;
+			} else if (str[i] == '}') {
+				if (str[i+1] != '}') return -1;
+				i++;
+			}
+		}
+		return n;
+	}
+};
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+template <typename T, T... C>
+constexpr PrintFormatString<C...> operator""_fmt() { return {}; }
+#pragma GCC diagnostic pop
+
 class Print
 {
   public:
@@ -152,12 +183,62 @@ class Print
 	int getWriteError() { return write_error; }
 	void clearWriteError() { setWriteError(0); }
 
+	// One argument to format(), which remembers its type.  Any integer,
+	// float, double, char, string, String or pointer may be used.
+	class FormatArg {
+	public:
+		enum Type : uint8_t { NONE, INT, UINT, INT64, UINT64, DOUBLE, CHAR, STRING, POINTER };
+		FormatArg() : type(NONE) { u = 0; }
+		FormatArg(char c) : type(CHAR) { u = (uint8_t)c; }
+		FormatArg(signed char n) : type(INT) { i = n; }
+		FormatArg(short n) : type(INT) { i = n; }
+		FormatArg(int n) : type(INT) { i = n; }
+		FormatArg(long n) : type(INT) { i = n; }
+		FormatArg(unsigned char n) : type(UINT) { u = n; }
+		FormatArg(unsigned short n) : type(UINT) { u = n; }
+		FormatArg(unsigned int n) : type(UINT) { u = n; }
+		FormatArg(unsigned long n) : type(UINT) { u = n; }
+		FormatArg(bool n) : type(UINT) { u = n; }
+		FormatArg(long long n) : type(INT64) { i64 = n; }
+		FormatArg(unsigned long long n) : type(UINT64) { u64 = n; }
+		FormatArg(double n) : type(DOUBLE) { d = n; }
+		FormatArg(const char *str) : type(STRING) { s = str; }
+		FormatArg(const String &str) : type(STRING) { s = str.c_str(); }
+		FormatArg(const __FlashStringHelper *str) : type(STRING) { s = (const char *)str; }
+		FormatArg(const void *ptr) : type(POINTER) { u = (uint32_t)(uintptr_t)ptr; }
+		Type type;
+		union {
+			int32_t i;
+			uint32_t u;
+			int64_t i64;
+			uint64_t u64;
+			double d;
+			const char *s;
+		};
+	};
+	// Print using a format string with {} placeholders, for example
+	// Serial.format("x={} y={:04X}\n"_fmt, x, y).  Each argument is printed
+	// according to its type, so printf's %d vs %ld mistakes can't happen.
+	// A placeholder may have a spec {:[<|>][0][width][.precision][type]},
+	// where type is d, x, X, o, b, c or s.  precision is the number of
+	// digits after the decimal point for float and double (default 2),
+	// or the maximum length of a string.  Use {{ and }} for literal braces.
+	// Output is gathered in a buffer on the stack and normally sent
+	// with a single write().
+	template <char... C, typename... Args>
+	size_t format(PrintFormatString<C...> fmt, const Args&... args) {
+		static_assert(PrintFormatString<C...>::count() >= 0, "format string has unbalanced { }");
+		static_assert(PrintFormatString<C...>::count() == sizeof...(Args),
+			"number of {} in format string does not match the arguments");
+		const FormatArg list[sizeof...(Args) + 1] = {FormatArg(args)...};
+		return vformat(fmt.str, list, sizeof...(Args));
+	}
 	// printf is a C standard function which allows you to print any number of variables using a somewhat cryptic format string
 	int printf(const char *format, ...);
 	// printf is a C standard function which allows you to print any number of variables using a somewhat cryptic format string
 	int printf(const __FlashStringHelper *format, ...);
 	// vprintf is a C standard function that allows you to print a variable argument list with a format string
-	int vprintf(const char *format, va_list ap) { return vdprintf((int)this, format, ap); }
+	int vprintf(const char *format, va_list ap) { return vdprintf((int)(intptr_t)this, format, ap); }
 
 	// format warnings are too pedantic - disable until newer toolchain offers better...
 	// https://forum.pjrc.com/threads/62473?p=256873&viewfull=1#post256873
@@ -168,8 +249,23 @@ class Print
   private:
 	int write_error;
 	size_t printFloat(double n, uint8_t digits);
-	size_t printNumber(unsigned long n, uint8_t base, uint8_t sign);
+	// base is almost always a constant, so pick the conversion at
+	// compile time when possible
+	size_t printNumber(unsigned long n, uint8_t base, uint8_t sign) {
+		if (__builtin_constant_p(base)) {
+			if (base == 10) return printNumberDec(n, sign);
+			if (base == 16) return printNumberPow2(n, 4, sign);
+			if (base == 2) return printNumberPow2(n, 1, sign);
+			if (base == 8) return printNumberPow2(n, 3, sign);
+			if (base == 0) return write((uint8_t)n);
+		}
+		return printNumberAny(n, base, sign);
+	}
+	size_t printNumberDec(unsigned long n, uint8_t sign);
+	size_t printNumberPow2(unsigned long n, uint8_t shift, uint8_t sign);
+	size_t printNumberAny(unsigned long n, uint8_t base, uint8_t sign);
 	size_t printNumber64(uint64_t n, uint8_t base, uint8_t sign);
+	size_t vformat(const char *fmt, const FormatArg *args, unsigned int count);
 };
 
 
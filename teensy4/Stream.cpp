@@ -51,34 +51,51 @@ int Stream::timedPeek()
   return -1;     // -1 indicates timeout
 }
 
+// Give received bytes to accept() until it returns false, leaving that
+// byte unread.  Streams with a read-ahead window are scanned in place,
+// without a millis() check and yield() for every byte.  Others use
+// timedPeek() and read().  Returns the byte which ended the scan, or -1
+// if timed out.
+template <typename F>
+int Stream::scan(F accept)
+{
+  while (1) {
+    const uint8_t *p;
+    size_t n = readAhead(&p);
+    if (n > 0) {
+      size_t i = 0;
+      while (i < n && accept(p[i])) i++;
+      if (i < n) {
+        int c = p[i];
+        consume(i);
+        return c;
+      }
+      consume(n);
+      continue;
+    }
+    int c = timedPeek();
+    if (c < 0 || !accept(c)) return c;
+    read();
+  }
+}
+
 // returns peek of the next digit in the stream or -1 if timeout
 // discards non-numeric characters
 int Stream::peekNextDigit(LookaheadMode lookahead, bool detectDecimal)
 {
-  int c;
-  while (1) {
-    c = timedPeek();
-
-    if( c < 0 ||
-        c == '-' ||
-        (c >= '0' && c <= '9') ||
-        (detectDecimal && c == '.')) return c;
-
-    switch( lookahead ){
-        case SKIP_NONE: return -1; // Fail code.
-        case SKIP_WHITESPACE:
-            switch( c ){
-                case ' ':
-                case '\t':
-                case '\r':
-                case '\n': break;
-                default: return -1; // Fail code.
-            }
-        case SKIP_ALL:
-            break;
+  int c = scan([=](int c) {
+    if (c == '-' || (c >= '0' && c <= '9') || (detectDecimal && c == '.')) return false;
+    if (lookahead == SKIP_NONE) return false;
+    if (lookahead == SKIP_WHITESPACE) {
+      return c == ' ' || c == '\t' || c == '\r' || c == '\n';
     }
-    read();  // discard non-numeric
-  }
+    return true; // discard non-numeric
+  });
+  if( c < 0 ||
+      c == '-' ||
+      (c >= '0' && c <= '9') ||
+      (detectDecimal && c == '.')) return c;
+  return -1; // Fail code.
 }
 
 // Public Methods
@@ -99,17 +116,18 @@ bool Stream::findUntil(const char *target, size_t targetLen, const char *termina
 {
   size_t index = 0;  // maximum target string length is 64k bytes!
   size_t termIndex = 0;
-  int c;
+  bool found = false;
 
   if( target == nullptr) return true;
   if( *target == 0) return true;   // return true if target is a null string
   if (terminator == nullptr) termLen = 0;
 
-  while( (c = timedRead()) > 0){
+  int c = scan([&](int c) {
+    if (c == 0) return false;
     if( c == target[index]){
-    //////Serial.print("found "); Serial.write(c); Serial.print("index now"); Serial.println(index+1);
       if(++index >= targetLen){ // return true if all chars in the target match
-        return true;
+        found = true;
+        return false;
       }
     }
     else{
@@ -121,8 +139,10 @@ bool Stream::findUntil(const char *target, size_t targetLen, const char *termina
     }
     else
         termIndex = 0;
-  }
-  return false;
+    return true;
+  });
+  if (c >= 0) read();  // consume the char which ended the search
+  return found;
 }
 
 // returns the first valid (long) integer value from the current position.
@@ -133,6 +153,7 @@ bool Stream::findUntil(const char *target, size_t targetLen, const char *termina
 long Stream::parseInt(LookaheadMode lookahead, char ignore)
 {
   bool isNegative = false;
+  bool first = true;
   long value = 0;
   int c;
 
@@ -141,17 +162,17 @@ long Stream::parseInt(LookaheadMode lookahead, char ignore)
   if(c < 0)
     return 0; // zero returned if timeout
 
-  do{
+  scan([&](int c) {
+    if (!first && !((c >= '0' && c <= '9') || c == ignore)) return false;
+    first = false;
     if(c == ignore)
       ; // ignore this character
     else if(c == '-')
       isNegative = true;
     else if(c >= '0' && c <= '9')        // is c a digit?
       value = value * 10 + c - '0';
-    read();  // consume the character we got with peek
-    c = timedPeek();
-  }
-  while( (c >= '0' && c <= '9') || c == ignore );
+    return true;
+  });
 
   if(isNegative)
     value = -value;
@@ -163,6 +184,7 @@ float Stream::parseFloat(LookaheadMode lookahead, char ignore)
 {
   bool isNegative = false;
   bool isFraction = false;
+  bool first = true;
   long value = 0;
   int c;
   float fraction = 1.0f;
@@ -172,7 +194,9 @@ float Stream::parseFloat(LookaheadMode lookahead, char ignore)
   if(c < 0)
     return 0; // zero returned if timeout
 
-  do{
+  scan([&](int c) {
+    if (!first && !((c >= '0' && c <= '9') || (c == '.' && !isFraction) || c == ignore)) return false;
+    first = false;
     if(c == ignore)
       ; // ignore
     else if(c == '-')
@@ -184,10 +208,8 @@ float Stream::parseFloat(LookaheadMode lookahead, char ignore)
       if(isFraction)
          fraction *= 0.1;
     }
-    read();  // consume the character we got with peek
-    c = timedPeek();
-  }
-  while( (c >= '0' && c <= '9')  || (c == '.' && !isFraction) || c == ignore );
+    return true;
+  });
 
   if(isNegative)
     value = -value;
@@ -207,6 +229,16 @@ size_t Stream::readBytes(char *buffer, size_t length)
 	if (buffer == nullptr) return 0;
 	size_t count = 0;
 	while (count < length) {
+		const uint8_t *p;
+		size_t n = readAhead(&p);
+		if (n > 0) {
+			if (n > length - count) n = length - count;
+			memcpy(buffer, p, n);
+			consume(n);
+			buffer += n;
+			count += n;
+			continue;
+		}
 		int c = timedRead();
 		if (c < 0) {
 			setReadError();
@@ -230,6 +262,20 @@ size_t Stream::readBytesUntil(char terminator, char *buffer, size_t length)
 	length--;
 	size_t index = 0;
 	while (index < length) {
+		const uint8_t *p;
+		size_t n = readAhead(&p);
+		if (n > 0) {
+			// copy directly from the stream's buffer, up to the terminator
+			if (n > length - index) n = length - index;
+			const uint8_t *t = (const uint8_t *)memchr(p, terminator, n);
+			size_t count = t ? t - p : n;
+			memcpy(buffer, p, count);
+			buffer += count;
+			index += count;
+			consume(t ? count + 1 : count);
+			if (t) break;
+			continue;
+		}
 		int c = timedRead();
 		if (c == terminator) break;
 		if (c < 0) {
@@ -243,36 +289,49 @@ size_t Stream::readBytesUntil(char terminator, char *buffer, size_t length)
 	return index; // return number of characters, not including null terminator
 }
 
-String Stream::readString(size_t max)
+// Append received data to str, up to max bytes (0 for unlimited), ending
+// at a zero byte or terminator (which are consumed but not appended),
+// or a timeout.  Streams with a read-ahead window are copied in blocks.
+void Stream::readStringInto(String &str, int terminator, size_t max)
 {
-	String str;
 	size_t length = 0;
 	while (length < max || !max) {
+		const uint8_t *p;
+		size_t n = readAhead(&p);
+		if (n > 0) {
+			if (max && n > max - length) n = max - length;
+			size_t count = 0;
+			while (count < n && p[count] != 0 && p[count] != terminator) count++;
+			str.concat((const char *)p, count);
+			length += count;
+			if (count < n) {
+				consume(count + 1);
+				break;
+			}
+			consume(count);
+			continue;
+		}
 		int c = timedRead();
 		if (c < 0) {
 			setReadError();
 			break;	// timeout
 		}
-		if (c == 0) break;
+		if (c == 0 || c == terminator) break;
 		str += (char)c;
 		length++;
 	}
+}
+
+String Stream::readString(size_t max)
+{
+	String str;
+	readStringInto(str, -1, max);
 	return str;
 }
 
 String Stream::readStringUntil(char terminator, size_t max)
 {
 	String str;
-	size_t length = 0;
-	while (length < max || !max) {
-		int c = timedRead();
-		if (c < 0) {
-			setReadError();
-			break;	// timeout
-		}
-		if (c == 0 || c == terminator) break;
-		str += (char)c;
-		length++;
-	}
+	readStringInto(str, (uint8_t)terminator, max);
 	return str;
 }
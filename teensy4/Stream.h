@@ -54,12 +54,20 @@ class Stream : public Print
 	bool findUntil(const String &target, size_t targetLen, const String &terminate, size_t termLen);
 	long parseInt(LookaheadMode lookahead = SKIP_ALL, char ignore = '\x01');
 	float parseFloat(LookaheadMode lookahead = SKIP_ALL, char ignore = '\x01');
-	size_t readBytes(char *buffer, size_t length);
+	// Virtual, so streams which copy received data in blocks are used that
+	// way through a Stream or HardwareSerial reference too.
+	virtual size_t readBytes(char *buffer, size_t length);
 	size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
 	size_t readBytesUntil(char terminator, char *buffer, size_t length);
 	size_t readBytesUntil(char terminator, uint8_t *buffer, size_t length) { return readBytesUntil(terminator, (char *)buffer, length); }
 	String readString(size_t max = 0 /* 0 means unlimited length */);
 	String readStringUntil(char terminator, size_t max = 0 /* 0 means unlimited length */);
+	// Direct access to received data, for streams which buffer it in
+	// memory.  Returns how many bytes can be read from *data without
+	// copying, or 0 if none are buffered or the stream can't do this.
+	// The data stays valid until consume(), which removes count of them.
+	virtual size_t readAhead(const uint8_t **data) { *data = nullptr; return 0; }
+	virtual void consume(size_t count) { while (count--) read(); }
 	int getReadError() { return read_error; }
 	void clearReadError() { setReadError(0); }
   protected:
@@ -70,6 +78,8 @@ class Stream : public Print
 
 	unsigned long _timeout;
   private:
+	template <typename F> int scan(F accept);
+	void readStringInto(String &str, int terminator, size_t max);
 	char read_error;
 };
 
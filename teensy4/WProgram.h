@@ -67,6 +67,7 @@
 #include "WString.h"
 #include "elapsedMillis.h"
 #include "IntervalTimer.h"
+#include "AnalogSampler.h"
 #include "CrashReport.h"
 
 uint16_t makeWord(uint16_t w);
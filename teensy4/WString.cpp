@@ -126,9 +126,20 @@ String::String(float num, unsigned char digits)
 	*this = dtostrf(num, digits + 2, digits, buf);
 }
 
+String::String(double num, unsigned char digits)
+{
+	init();
+	char buf[40];
+	if (dtoa_fixed(num, digits, buf) > 0) {
+		*this = buf;
+	} else {
+		*this = dtostrf(num, digits + 2, digits, buf);
+	}
+}
+
 String::~String()
 {
-	free(buffer);
+	freeBuffer();
 }
 
 /*********************************************/
@@ -155,7 +166,24 @@ unsigned char String::reserve(unsigned int size)
 
 unsigned char String::changeBuffer(unsigned int maxStrLen)
 {
-	char *newbuffer = (char *)realloc(buffer, maxStrLen + 1);
+	char *newbuffer;
+
+	if (maxStrLen < sizeof(inline_buf) && (!buffer || buffer == inline_buf)) {
+		buffer = inline_buf;
+		capacity = sizeof(inline_buf) - 1;
+		return 1;
+	}
+	// grow by at least half, so a loop of appends doesn't realloc
+	// (and fragment the heap) on every call
+	if (buffer && maxStrLen < capacity + (capacity >> 1)) {
+		maxStrLen = capacity + (capacity >> 1);
+	}
+	if (buffer == inline_buf) {
+		newbuffer = (char *)malloc(maxStrLen + 1);
+		if (newbuffer) memcpy(newbuffer, inline_buf, len + 1);
+	} else {
+		newbuffer = (char *)realloc(buffer, maxStrLen + 1);
+	}
 	if (newbuffer) {
 		buffer = newbuffer;
 		capacity = maxStrLen;
@@ -177,7 +205,7 @@ String & String::copy(const char *cstr, unsigned int length)
 	}
 	if (!reserve(length)) {
 		if (buffer) {
-			free(buffer);
+			freeBuffer();
 			buffer = NULL;
 		}
 		len = capacity = 0;
@@ -191,7 +219,13 @@ String & String::copy(const char *cstr, unsigned int length)
 void String::move(String &rhs)
 {
 	if (&rhs == this) return;
-	if (buffer) free(buffer);
+	if (rhs.buffer == rhs.inline_buf) {
+		// short strings are copied, there is no heap buffer to take
+		copy(rhs.inline_buf, rhs.len);
+		rhs.init();
+		return;
+	}
+	if (buffer) freeBuffer();
 	buffer = rhs.buffer;
 	capacity = rhs.capacity;
 	len = rhs.len;
@@ -263,12 +297,9 @@ String & String::append(const char *cstr, unsigned int length)
 		buffer_offset = (unsigned int)(cstr-buffer);
 	}
 	if (length == 0 || !reserve(newlen)) return *this;
-	if ( self ) {
-		memcpy(buffer + len, buffer+buffer_offset, length);
-		buffer[newlen] = 0;
-		}
-	else
-		strcpy(buffer + len, cstr);
+	if ( self ) cstr = buffer + buffer_offset;
+	memcpy(buffer + len, cstr, length);
+	buffer[newlen] = 0;
 	len = newlen;
 	return *this;
 }
@@ -344,6 +375,15 @@ String & String::append(float num)
 	return *this;
 }
 
+String & String::append(double num)
+{
+	char buf[40];
+	int len = dtoa_fixed(num, 2, buf);
+	if (len == 0) return append((float)num);
+	append(buf, len);
+	return *this;
+}
+
 
 /*********************************************/
 /*  Concatenate                              */
@@ -45,6 +45,16 @@ class __FlashStringHelper;
 #define F(string_literal) ((const __FlashStringHelper *)(string_literal))
 #endif
 
+// Strings up to STRING_INLINE_SIZE - 1 chars are stored inside the String
+// object, without using malloc.  The cost is RAM in every String, even
+// those using the heap: sizeof(String) is 28 bytes, rather than 12 without
+// inline storage.  Code compiled with a different STRING_INLINE_SIZE, or
+// against older headers, can't share String objects.  Where many Strings
+// exist, a smaller STRING_INLINE_SIZE (at least 1) saves RAM.
+#ifndef STRING_INLINE_SIZE
+#define STRING_INLINE_SIZE 16
+#endif
+
 // An inherited class for holding the result of a concatenation.  These
 // result objects are assumed to be writable by subsequent concatenations.
 class StringSumHelper;
@@ -70,7 +80,7 @@ public:
 	String(long long, unsigned char base=10);
 	String(unsigned long long, unsigned char base=10);
         String(float num, unsigned char digits=2);
-	String(double num, unsigned char digits=2) : String((float)num, digits) {}
+	String(double num, unsigned char digits=2);
 	~String(void);
 
 	// memory management
@@ -103,7 +113,7 @@ public:
 	String & append(long long num);
 	String & append(unsigned long long num);
 	String & append(float num);
-	String & append(double num)			{return append((float)num);}
+	String & append(double num);
 	String & operator += (const String &rhs)	{return append(rhs);}
 	String & operator += (const char *cstr)		{return append(cstr);}
 	String & operator += (const __FlashStringHelper *pgmstr) {return append(pgmstr);}
@@ -134,6 +144,7 @@ public:
 	friend StringSumHelper & operator + (const StringSumHelper &lhs, double num);
 	String & concat(const String &str)		{return append(str);}
 	String & concat(const char *cstr)		{return append(cstr);}
+	String & concat(const char *cstr, unsigned int length) {return append(cstr, length);}
 	String & concat(const __FlashStringHelper *pgmstr) {return append(pgmstr);}
 	String & concat(char c)				{return append(c);}
 	String & concat(unsigned char c)		{return append((int)c);}
@@ -210,12 +221,14 @@ public:
 	float toFloat(void) const;
 
 protected:
-	char *buffer;	        // the actual char array
+	char *buffer;	        // the actual char array, on the heap or inline
 	unsigned int capacity;  // the array length minus one (for the '\0')
 	unsigned int len;       // the String length (not counting the '\0')
+	char inline_buf[STRING_INLINE_SIZE]; // buffer for short strings
 	//unsigned char flags;    // unused, for future features
 protected:
 	void init(void);
+	void freeBuffer(void) { if (buffer != inline_buf) free(buffer); }
 	unsigned char changeBuffer(unsigned int maxStrLen);
 	String & append(const char *cstr, unsigned int length);
 private:
@@ -232,6 +245,9 @@ class StringSumHelper : public String
 {
 public:
 	StringSumHelper(const String &s) : String(s) {}
+	#if __cplusplus >= 201103L || defined(__GXX_EXPERIMENTAL_CXX0X__)
+	StringSumHelper(String &&s) : String((String &&)s) {}
+	#endif
 	StringSumHelper(const char *p) : String(p) {}
 	StringSumHelper(const __FlashStringHelper *pgmstr) : String(pgmstr) {}
 	StringSumHelper(char c) : String(c) {}
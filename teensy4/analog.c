@@ -6,6 +6,10 @@
 static uint8_t calibrating;
 static uint8_t analog_config_bits = 10;
 static uint8_t analog_num_average = 4;
+static uint8_t async_pin[2] = {255, 255}; // pin converting on ADC1, ADC2 for analogReadStart()
+static uint8_t continuous_pit = 255; // PIT channel triggering analog_continuous_begin()
+
+void xbar_connect(unsigned int input, unsigned int output); // in pwm.c
 
 
 const uint8_t pin_to_channel[] = { // pg 482
@@ -68,16 +72,18 @@ static void wait_for_cal(void)
 }
 
 
-int analogRead(uint8_t pin)
+// Pins on AD_B1 connect to the same channel of both ADCs.  A10 & A11
+// (channels 1 & 2, on AD_B0) are only on ADC1, and 128+n only on ADC2.
+#define CHANNEL_ON_ADC1(ch)  (!((ch) & 0x80))
+#define CHANNEL_ON_ADC2(ch)  (((ch) & 0x80) || ((ch) != 1 && (ch) != 2))
+
+// Look up a pin's ADC channel and prepare the pin for analog input.
+// Returns 255 if the pin has no analog input.
+static uint8_t analog_pin_setup(uint8_t pin)
 {
-	// TODO: what happens if a program calls analogRead() from both main
-	// program and interrupts?  On Teensy 3.x this came up and code was
-	// added to allow analogRead() to work (or at least not hang) in
-	// when used from interrupts & main program.
-	if (pin > sizeof(pin_to_channel)) return 0;
-	if (calibrating) wait_for_cal();
+	if (pin >= sizeof(pin_to_channel)) return 255;
 	uint8_t ch = pin_to_channel[pin];
-	if (ch == 255) return 0;
+	if (ch == 255) return 255;
 	// check if pin has input "keeper"
 	volatile uint32_t *pad = portControlRegister(pin);
 	uint32_t padval = *pad;
@@ -87,8 +93,36 @@ int analogRead(uint8_t pin)
 		// people use together with capacitors or other circuitry
 		*pad = padval & ~IOMUXC_PAD_PKE;
 	}
+	return ch;
+}
+
+int analogRead(uint8_t pin)
+{
+	// TODO: what happens if a program calls analogRead() from both main
+	// program and interrupts?  On Teensy 3.x this came up and code was
+	// added to allow analogRead() to work (or at least not hang) in
+	// when used from interrupts & main program.
+	if (calibrating) wait_for_cal();
+	uint8_t ch = analog_pin_setup(pin);
+	if (ch == 255) return 0;
+	if (continuous_pit != 255) return 0; // ADCs in use by AnalogSampler
 //	printf("%d\n", ch);
 //	if (ch > 15) return 0;
+	// A reading begun by analogReadStart() on the same ADC would be lost
+	// when this one starts, so wait for it.  If it's for this pin, it's
+	// the result, otherwise it's discarded.  Either way, analogReadResult()
+	// then returns -1 for it.
+	uint32_t n = (ch & 0x80) ? 1 : 0;
+	if (async_pin[n] != 255) {
+		volatile uint32_t *hs = n ? &ADC2_HS : &ADC1_HS;
+		while (!(*hs & ADC_HS_COCO0)) {
+			yield();
+		}
+		int val = n ? ADC2_R0 : ADC1_R0;
+		uint8_t async = async_pin[n];
+		async_pin[n] = 255;
+		if (async == pin) return val;
+	}
 	if(!(ch & 0x80)) {
 		ADC1_HC0 = ch;
 		while (!(ADC1_HS & ADC_HS_COCO0)) {
@@ -104,6 +138,155 @@ int analogRead(uint8_t pin)
 	}
 }
 
+// Begin reading a pin without waiting.  Uses whichever ADC connected to the
+// pin is idle, so 2 pins can convert at once.  Returns 1 if started, or 0
+// if the pin isn't analog or its ADCs are busy.  Get the result with
+// analogReadResult().  An analogRead() which needs the same ADC first
+// waits for this reading, and takes it if the pin is the same.
+int analogReadStart(uint8_t pin)
+{
+	if (calibrating) wait_for_cal();
+	uint8_t ch = analog_pin_setup(pin);
+	if (ch == 255) return 0;
+	if (CHANNEL_ON_ADC1(ch) && async_pin[0] == 255 && !(ADC1_CFG & ADC_CFG_ADTRG)) {
+		async_pin[0] = pin;
+		ADC1_HC0 = ch;
+		return 1;
+	}
+	if (CHANNEL_ON_ADC2(ch) && async_pin[1] == 255 && !(ADC2_CFG & ADC_CFG_ADTRG)) {
+		async_pin[1] = pin;
+		ADC2_HC0 = ch & 0x7f;
+		return 1;
+	}
+	return 0;
+}
+
+// Has the reading begun by analogReadStart() finished?
+int analogReadComplete(uint8_t pin)
+{
+	if (async_pin[0] == pin) return (ADC1_HS & ADC_HS_COCO0) ? 1 : 0;
+	if (async_pin[1] == pin) return (ADC2_HS & ADC_HS_COCO0) ? 1 : 0;
+	return 0;
+}
+
+// Get the reading begun by analogReadStart(), waiting if it isn't finished.
+// Returns -1 if no reading was started for this pin.
+int analogReadResult(uint8_t pin)
+{
+	if (async_pin[0] == pin) {
+		while (!(ADC1_HS & ADC_HS_COCO0)) {
+			yield();
+		}
+		async_pin[0] = 255;
+		return ADC1_R0;
+	}
+	if (async_pin[1] == pin) {
+		while (!(ADC2_HS & ADC_HS_COCO0)) {
+			yield();
+		}
+		async_pin[1] = 255;
+		return ADC2_R0;
+	}
+	return -1;
+}
+
+// Configure both ADCs to sample up to 8 pins, rate times per second, with
+// a PIT timer triggering ADC_ETC through XBAR1.  Each ADC converts up to 4
+// pins back to back, into ADC_ETC trigger 0 results (ADC1) and trigger 4
+// results (ADC2).  slot[i] is set to where pins[i] is found in the 8
+// results, 0-3 for ADC1 and 4-7 for ADC2.  The trigger which finishes
+// last requests DMA; its number is returned, or -1 on error.  Used by
+// AnalogSampler, which reads the results with DMA.
+int analog_continuous_begin(const uint8_t *pins, uint32_t count, uint32_t rate, uint8_t *slot)
+{
+	uint8_t chain[2][4];
+	uint32_t len[2] = {0, 0};
+	uint32_t i, n;
+
+	if (count < 1 || count > 8 || rate < 1 || rate > 24000000) return -1;
+	if (async_pin[0] != 255 || async_pin[1] != 255) return -1;
+	if (continuous_pit != 255) return -1;
+	if (calibrating) wait_for_cal();
+	// assign pins to ADCs, in the order given when both are possible
+	for (i=0; i < count; i++) {
+		uint8_t ch = analog_pin_setup(pins[i]);
+		if (ch == 255) return -1;
+		if (CHANNEL_ON_ADC1(ch) && len[0] < 4) {
+			n = 0;
+		} else if (CHANNEL_ON_ADC2(ch) && len[1] < 4) {
+			n = 1;
+		} else {
+			return -1;
+		}
+		slot[i] = n * 4 + len[n];
+		chain[n][len[n]++] = ch & 0x7f;
+	}
+	// find a PIT channel not used by IntervalTimer
+	CCM_CCGR1 |= CCM_CCGR1_PIT(CCM_CCGR_ON);
+	PIT_MCR = 1;
+	for (n=0; n < 4; n++) {
+		if (IMXRT_PIT_CHANNELS[n].TCTRL == 0) break;
+	}
+	if (n >= 4) return -1;
+	continuous_pit = n;
+	CCM_CCGR2 |= CCM_CCGR2_XBAR1(CCM_CCGR_ON);
+	xbar_connect(XBARA1_IN_PIT_TRIGGER0 + n, XBARA1_OUT_ADC_ETC_TRIG00);
+	xbar_connect(XBARA1_IN_PIT_TRIGGER0 + n, XBARA1_OUT_ADC_ETC_TRIG10);
+
+	// the longer chain finishes last.  If equal, a short delay before
+	// ADC1 begins makes sure it finishes after ADC2.
+	int last = (len[0] >= len[1]) ? 0 : 4;
+	ADC_ETC_CTRL = ADC_ETC_CTRL_SOFTRST;
+	ADC_ETC_CTRL = 0;
+	ADC_ETC_DMA_CTRL = ADC_ETC_DMA_CTRL_TRIQ_ENABLE(last);
+	uint32_t enable = 0;
+	for (n=0; n < 2; n++) {
+		if (len[n] == 0) continue;
+		int trig = n * 4;
+		volatile uint32_t *hc = (n == 0) ? &ADC1_HC0 : &ADC2_HC0;
+		volatile uint32_t *cfg = (n == 0) ? &ADC1_CFG : &ADC2_CFG;
+		uint32_t chain_1_0 = 0, chain_3_2 = 0;
+		for (i=0; i < len[n]; i++) {
+			// segment i converts using ADC's HCi, result also in Ri
+			uint32_t seg = ADC_ETC_TRIG_CHAIN_CSEL0(chain[n][i])
+				| ADC_ETC_TRIG_CHAIN_HWTS0(1 << i) | ADC_ETC_TRIG_CHAIN_B2B0;
+			if (i & 1) seg <<= 16;
+			if (i < 2) chain_1_0 |= seg;
+			else chain_3_2 |= seg;
+			hc[i] = ADC_HC_ADCH(16); // channel selected by ADC_ETC
+		}
+		IMXRT_ADC_ETC.TRIG[trig].CTRL = ADC_ETC_TRIG_CTRL_TRIG_CHAIN(len[n] - 1);
+		IMXRT_ADC_ETC.TRIG[trig].COUNTER = (trig == last && len[0] == len[1]) ?
+			ADC_ETC_TRIG_COUNTER_INIT_DELAY(32) : 0;
+		IMXRT_ADC_ETC.TRIG[trig].CHAIN_1_0 = chain_1_0;
+		IMXRT_ADC_ETC.TRIG[trig].CHAIN_3_2 = chain_3_2;
+		*cfg |= ADC_CFG_ADTRG;
+		enable |= ADC_ETC_CTRL_TRIG_ENABLE(1 << trig);
+	}
+	// TSC_BYPASS gives ADC2 to ADC_ETC instead of the touch screen controller
+	ADC_ETC_CTRL = ADC_ETC_CTRL_TSC_BYPASS | enable;
+
+	IMXRT_PIT_CHANNEL_t *pit = IMXRT_PIT_CHANNELS + continuous_pit;
+	pit->LDVAL = 24000000 / rate - 1;
+	pit->TCTRL = PIT_TCTRL_TEN; // no interrupt, only the trigger to XBAR1
+	return last;
+}
+
+// Stop sampling started by analog_continuous_begin() and give both ADCs
+// back to analogRead().
+void analog_continuous_end(void)
+{
+	if (continuous_pit == 255) return;
+	IMXRT_PIT_CHANNELS[continuous_pit].TCTRL = 0;
+	continuous_pit = 255;
+	ADC_ETC_CTRL = 0;
+	ADC_ETC_DMA_CTRL = 0;
+	ADC1_CFG &= ~ADC_CFG_ADTRG;
+	ADC2_CFG &= ~ADC_CFG_ADTRG;
+	ADC1_HC0 = ADC_HC_ADCH(31); // 31 = conversion off
+	ADC2_HC0 = ADC_HC_ADCH(31);
+}
+
 void analogReference(uint8_t type __attribute__((unused)))
 {
 }
@@ -46,6 +46,9 @@ void eeprom_write_byte(uint8_t *addr, uint8_t value);
 void eeprom_write_word(uint16_t *addr, uint16_t value);
 void eeprom_write_dword(uint32_t *addr, uint32_t value);
 void eeprom_write_block(const void *buf, void *addr, uint32_t len);
+void eeprom_transaction_begin(void);
+void eeprom_transaction_commit(void);
+uint8_t * eeprom_ram_shadow(void);
 int eeprom_is_ready(void);
 #define eeprom_busy_wait() do {} while (!eeprom_is_ready())
 
@@ -107,6 +110,7 @@ static inline char * itoa(int val, char *buf, int radix) { return ltoa(val, buf,
 #endif */
 
 char * dtostrf(float val, int width, unsigned int precision, char *buf);
+int dtoa_fixed(double val, unsigned int precision, char *buf);
 
 
 #ifdef __cplusplus
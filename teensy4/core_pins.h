@@ -2341,6 +2341,15 @@ void _init_Teensyduino_internal_(void);
 // pin number, or names A0 to A17.  Unless analogReadResolution() was used, the
 // return value is a number from 0 to 1023, representing 0 to 3.3 volts.
 int analogRead(uint8_t pin);
+// Begin reading an analog pin without waiting.  Teensy 4 has 2 ADCs, so
+// readings of 2 pins can happen at the same time.  Returns 1 if started, or
+// 0 if the ADCs connected to this pin are busy.
+int analogReadStart(uint8_t pin);
+// Returns 1 when the reading begun by analogReadStart() is complete.
+int analogReadComplete(uint8_t pin);
+// Get the reading begun by analogReadStart(), waiting if necessary.  Every
+// reading started must be collected with this function.
+int analogReadResult(uint8_t pin);
 // On Teensy 4, analogRead() always uses the 3.3V power as its reference.  This
 // function has no effect, but is provided to allow programs developed for
 // Arduino boards to compile.
@@ -2419,6 +2428,27 @@ extern uint8_t yield_active_check_flags;
 #define YIELD_CHECK_EVENT_RESPONDER 0x04  // User has created eventResponders that use yield
 #define YIELD_CHECK_USB_SERIALUSB1  0x08  // Check for SerialUSB1
 #define YIELD_CHECK_USB_SERIALUSB2  0x10  // Check for SerialUSB2
+#define YIELD_CHECK_FIBERS          0x20  // Fiber tasks are running
+#define YIELD_CHECK_HOOKS           0x40  // functions added with yield_hook_add()
+
+// Libraries needing background service may add a function for yield() to
+// call, instead of requiring the sketch to call it from loop().  Returns 0
+// if YIELD_HOOKS_MAX functions are already added.
+#define YIELD_HOOKS_MAX 8
+typedef void (*yield_hook_function_t)(void);
+int yield_hook_add(yield_hook_function_t function);
+int yield_hook_remove(yield_hook_function_t function);
+
+// Measure the CPU time yield() spends in each function.  Index 0 to 5 are
+// the built in checks, in YIELD_CHECK bit order, followed by the functions
+// added with yield_hook_add().  yield_stats() returns 0 past the last one.
+struct yield_hook_stats {
+	uint32_t calls;
+	uint32_t cycles;     // total, in F_CPU_ACTUAL cycles
+	uint32_t max_cycles; // longest single call
+};
+void yield_stats_enable(int enable); // counts are cleared when enabled
+int yield_stats(unsigned int index, yield_hook_function_t *function, struct yield_hook_stats *stats);
 
 // Allow other functions to run.  Typically these will be serial event handlers
 // and functions call by certain libraries when lengthy operations complete.
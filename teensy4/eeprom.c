@@ -33,12 +33,24 @@
 // Generally you should avoid editing this code, unless you really
 // know what you're doing.
 
+// EEPROM_HOST_SIMULATION builds this file for a normal computer, to test
+// and measure the log format without hardware.  The flash is an array in
+// RAM, and the test program provides the eepromemu_flash functions, which
+// count erase and program operations and the time they would take.
+#if defined(EEPROM_HOST_SIMULATION)
+#include <stdint.h>
+#else
 #include "imxrt.h"
+#endif
 #include <avr/eeprom.h>
 #include <string.h>
 #include "debug/printf.h"
 
-#if defined(ARDUINO_TEENSY40)
+#if defined(EEPROM_HOST_SIMULATION)
+extern uint8_t eeprom_host_flash[];
+#define FLASH_BASEADDR ((uintptr_t)eeprom_host_flash)
+#define FLASH_SECTORS  63
+#elif defined(ARDUINO_TEENSY40)
 #define FLASH_BASEADDR 0x601F0000
 #define FLASH_SECTORS  15
 #elif defined(ARDUINO_TEENSY41)
@@ -63,6 +75,31 @@ void eepromemu_flash_erase_sector(void *addr);
 void eepromemu_flash_erase_32K_block(void *addr);
 void eepromemu_flash_erase_64K_block(void *addr);
 
+// Each sector is a log of 16 bit entries, the low byte is an offset within
+// the sector and the high byte is data.  The last entry for an offset wins.
+// Every 4 bytes of EEPROM address go to the next sector.
+#define ADDR_TO_SECTOR(addr)		(((addr) >> 2) % FLASH_SECTORS)
+#define ADDR_TO_OFFSET(addr)		(((addr) & 3) | ((((addr) >> 2) / FLASH_SECTORS) << 2))
+#define SECTOR_TO_ADDR(sector, offset)	(((((offset) >> 2) * FLASH_SECTORS + (sector)) << 2) | ((offset) & 3))
+#define SECTOR_ENTRIES			2048
+
+// A copy of all EEPROM data is kept in RAM, at the cost of E2END+1 bytes.
+// Reads are as fast as memory, and writes between eeprom_transaction_begin()
+// and _commit() only change RAM until the commit.  Programs which need the
+// RAM more can turn it off by defining their own eeprom_ram_shadow():
+//   extern "C" uint8_t * eeprom_ram_shadow(void) { return NULL; }
+// Then the linker discards the default buffer, reads scan the flash logs
+// and writes always happen immediately.
+uint8_t * eeprom_ram_shadow_default(void)
+{
+	static uint8_t buffer[E2END+1];
+	return buffer;
+}
+uint8_t * eeprom_ram_shadow(void) __attribute__ ((weak, alias("eeprom_ram_shadow_default")));
+
+static uint8_t *shadow=NULL;
+static uint8_t transaction=0;
+static uint64_t dirty_sectors=0;
 static uint8_t initialized=0;
 static uint16_t sector_index[FLASH_SECTORS];
 
@@ -70,12 +107,19 @@ void eeprom_initialize(void)
 {
 	uint32_t sector;
 	//printf("eeprom init\n");
+	shadow = eeprom_ram_shadow();
+	if (shadow) memset(shadow, 0xFF, E2END+1);
 	for (sector=0; sector < FLASH_SECTORS; sector++) {
 		const uint16_t *p = (uint16_t *)(FLASH_BASEADDR + sector * 4096);
 		const uint16_t *end = (uint16_t *)(FLASH_BASEADDR + (sector + 1) * 4096);
 		uint16_t index = 0;
 		do {
-			if (*p++ == 0xFFFF) break;
+			uint32_t val = *p++;
+			if (val == 0xFFFF) break;
+			if (shadow) {
+				uint32_t addr = SECTOR_TO_ADDR(sector, val & 255);
+				if (addr <= E2END) shadow[addr] = val >> 8;
+			}
 			index++;
 		} while (p < end);
 		sector_index[sector] = index;
@@ -83,17 +127,73 @@ void eeprom_initialize(void)
 	initialized = 1;
 }
 
+// Replay a sector's log into a 256 byte image, indexed by offset
+static void sector_read(uint32_t sector, uint8_t *image)
+{
+	const uint16_t *p = (uint16_t *)(FLASH_BASEADDR + sector * 4096);
+	const uint16_t *end = p + sector_index[sector];
+
+	memset(image, 0xFF, 256);
+	while (p < end) {
+		uint32_t val = *p++;
+		image[val & 255] = val >> 8;
+	}
+}
+
+// Program log entries, without crossing the flash's 256 byte pages
+static void log_append(uint16_t *p, const uint16_t *entries, uint32_t count)
+{
+	while (count > 0) {
+		uint32_t n = (256 - ((uint32_t)p & 255)) >> 1;
+		if (n > count) n = count;
+		eepromemu_flash_write(p, entries, n * 2);
+		p += n;
+		entries += n;
+		count -= n;
+	}
+}
+
+// Add changed bytes to a sector, with at most one erase when its log is full.
+// Each offset may appear only once in entries.
+static void sector_write(uint32_t sector, const uint16_t *entries, uint32_t count)
+{
+	uint16_t *p = (uint16_t *)(FLASH_BASEADDR + sector * 4096);
+	uint8_t image[256];
+	uint16_t log[256];
+	uint32_t i, index;
+
+	if (sector_index[sector] + count <= SECTOR_ENTRIES) {
+		//printf("ee_wr, writing\n");
+		log_append(p + sector_index[sector], entries, count);
+		sector_index[sector] += count;
+		return;
+	}
+	//printf("ee_wr, erase then write\n");
+	sector_read(sector, image);
+	for (i=0; i < count; i++) {
+		image[entries[i] & 255] = entries[i] >> 8;
+	}
+	eepromemu_flash_erase_sector(p);
+	index = 0;
+	for (i=0; i < 256; i++) {
+		if (image[i] != 0xFF) log[index++] = i | (image[i] << 8);
+	}
+	log_append(p, log, index);
+	sector_index[sector] = index;
+}
+
 uint8_t eeprom_read_byte(const uint8_t *addr_ptr)
 {
 	uint32_t addr = (uint32_t)addr_ptr;
-	uint32_t sector, offset;
-	const uint16_t *p, *end;
 	uint8_t data=0xFF;
 
 	if (addr > E2END) return 0xFF;
 	if (!initialized) eeprom_initialize();
-	sector = (addr >> 2) % FLASH_SECTORS;
-	offset = (addr & 3) | (((addr >> 2) / FLASH_SECTORS) << 2);
+	if (shadow) return shadow[addr];
+	uint32_t sector, offset;
+	const uint16_t *p, *end;
+	sector = ADDR_TO_SECTOR(addr);
+	offset = ADDR_TO_OFFSET(addr);
 	//printf("ee_rd, addr=%u, sector=%u, offset=%u, len=%u\n",
 		//addr, sector, offset, sector_index[sector]);
 	p = (uint16_t *)(FLASH_BASEADDR + sector * 4096);
@@ -107,76 +207,56 @@ uint8_t eeprom_read_byte(const uint8_t *addr_ptr)
 
 void eeprom_write_byte(uint8_t *addr_ptr, uint8_t data)
 {
-	uint32_t addr = (uint32_t)addr_ptr;
-	uint32_t sector, offset, index, i;
-	uint16_t *p, *end;
-	uint8_t olddata=0xFF;
-	uint8_t buf[256];
-
-	if (addr > E2END) return;
-	if (!initialized) eeprom_initialize();
-
-	sector = (addr >> 2) % FLASH_SECTORS; 
-	offset = (addr & 3) | (((addr >> 2) / FLASH_SECTORS) << 2);
-	//printf("ee_wr, addr=%u, sector=%u, offset=%u, len=%u\n",
-		//addr, sector, offset, sector_index[sector]);
-	p = (uint16_t *)(FLASH_BASEADDR + sector * 4096);
-	end = p + sector_index[sector];
-	while (p < end) {
-		uint16_t val = *p++;
-		if ((val & 255) == offset) olddata = val >> 8;
-	}
-	if (data == olddata) return;
-	if (sector_index[sector] < 2048) {
-		//printf("ee_wr, writing\n");
-		uint16_t newdata = offset | (data << 8);
-		eepromemu_flash_write(end, &newdata, 2);
-		sector_index[sector] = sector_index[sector] + 1;
-	} else {
-		//printf("ee_wr, erase then write\n");
-		memset(buf, 0xFF, sizeof(buf));
-		p = (uint16_t *)(FLASH_BASEADDR + sector * 4096);
-		end = p + 2048;
-		while (p < end) {
-			uint16_t val = *p++;
-			buf[val & 255] = val >> 8;
-		}
-		buf[offset] = data;
-		p = (uint16_t *)(FLASH_BASEADDR + sector * 4096);
-		eepromemu_flash_erase_sector(p);
-		index = 0;
-		for (i=0; i < 256; i++) {
-			if (buf[i] != 0xFF) {
-				// TODO: combining these to larger write
-				// would (probably) be more efficient
-				uint16_t newval = i | (buf[i] << 8);
-				eepromemu_flash_write(p + index, &newval, 2);
-				index = index + 1;
-			}
-		}
-		sector_index[sector] = index;
-	}
+	eeprom_write_block(&data, addr_ptr, 1);
 }
 
 uint16_t eeprom_read_word(const uint16_t *addr)
 {
-	const uint8_t *p = (const uint8_t *)addr;
-	return eeprom_read_byte(p) | (eeprom_read_byte(p+1) << 8);
+	uint8_t buf[2];
+	eeprom_read_block(buf, addr, 2);
+	return buf[0] | (buf[1] << 8);
 }
 
 uint32_t eeprom_read_dword(const uint32_t *addr)
 {
-	const uint8_t *p = (const uint8_t *)addr;
-	return eeprom_read_byte(p) | (eeprom_read_byte(p+1) << 8)
-		| (eeprom_read_byte(p+2) << 16) | (eeprom_read_byte(p+3) << 24);
+	uint8_t buf[4];
+	eeprom_read_block(buf, addr, 4);
+	return buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
 }
 
 void eeprom_read_block(void *buf, const void *addr, uint32_t len)
 {
-	const uint8_t *p = (const uint8_t *)addr;
+	uint32_t start = (uint32_t)addr;
 	uint8_t *dest = (uint8_t *)buf;
-	while (len--) {
-		*dest++ = eeprom_read_byte(p++);
+
+	if (len == 0) return;
+	if (!initialized) eeprom_initialize();
+	if (start > E2END) {
+		memset(dest, 0xFF, len);
+		return;
+	}
+	if (len > E2END + 1 - start) {
+		memset(dest + (E2END + 1 - start), 0xFF, len - (E2END + 1 - start));
+		len = E2END + 1 - start;
+	}
+	if (shadow) {
+		memcpy(dest, shadow + start, len);
+		return;
+	}
+	// scan each sector's log only once
+	uint32_t last = start + len - 1;
+	uint32_t group, g, i;
+	uint8_t image[256];
+	for (group = start >> 2; group <= (last >> 2) && group < (start >> 2) + FLASH_SECTORS; group++) {
+		uint32_t sector = group % FLASH_SECTORS;
+		sector_read(sector, image);
+		for (g = group; g <= (last >> 2); g += FLASH_SECTORS) {
+			for (i = 0; i < 4; i++) {
+				uint32_t a = (g << 2) | i;
+				if (a < start || a > last) continue;
+				dest[a - start] = image[ADDR_TO_OFFSET(a)];
+			}
+		}
 	}
 }
 
@@ -185,34 +265,102 @@ int eeprom_is_ready(void)
 	return 1;
 }
 
+// Between begin and commit, writes only go to RAM.  Commit then updates
+// each changed sector once, so a group of writes costs at most one erase
+// per sector.  Without the RAM shadow, writes happen immediately.
+void eeprom_transaction_begin(void)
+{
+	if (!initialized) eeprom_initialize();
+	if (shadow) transaction = 1;
+}
+
+void eeprom_transaction_commit(void)
+{
+	uint32_t sector, offset, addr, count;
+	uint8_t image[256];
+	uint16_t entries[256];
+
+	if (!transaction) return;
+	transaction = 0;
+	for (sector=0; sector < FLASH_SECTORS; sector++) {
+		if (!(dirty_sectors & ((uint64_t)1 << sector))) continue;
+		sector_read(sector, image);
+		count = 0;
+		for (offset=0; offset < 256; offset++) {
+			addr = SECTOR_TO_ADDR(sector, offset);
+			if (addr > E2END) break;
+			if (shadow[addr] != image[offset]) {
+				entries[count++] = offset | (shadow[addr] << 8);
+			}
+		}
+		if (count > 0) sector_write(sector, entries, count);
+	}
+	dirty_sectors = 0;
+}
+
 void eeprom_write_word(uint16_t *addr, uint16_t value)
 {
-	uint8_t *p = (uint8_t *)addr;
-	eeprom_write_byte(p++, value);
-	eeprom_write_byte(p, value >> 8);
+	uint8_t buf[2] = {value, value >> 8};
+	eeprom_write_block(buf, addr, 2);
 }
 
 void eeprom_write_dword(uint32_t *addr, uint32_t value)
 {
-	uint8_t *p = (uint8_t *)addr;
-	eeprom_write_byte(p++, value);
-	eeprom_write_byte(p++, value >> 8);
-	eeprom_write_byte(p++, value >> 16);
-	eeprom_write_byte(p, value >> 24);
+	uint8_t buf[4] = {value, value >> 8, value >> 16, value >> 24};
+	eeprom_write_block(buf, addr, 4);
 }
 
 void eeprom_write_block(const void *buf, void *addr, uint32_t len)
 {
-	uint8_t *p = (uint8_t *)addr;
+	uint32_t start = (uint32_t)addr;
 	const uint8_t *src = (const uint8_t *)buf;
-	while (len--) {
-		eeprom_write_byte(p++, *src++);
+	uint32_t last, group, g, i, count;
+	uint16_t entries[256];
+	uint8_t image[256];
+
+	if (len == 0 || start > E2END) return;
+	if (!initialized) eeprom_initialize();
+	if (len > E2END + 1 - start) len = E2END + 1 - start;
+	if (transaction) {
+		// only the shadow changes until eeprom_transaction_commit()
+		for (i = 0; i < len; i++) {
+			if (shadow[start + i] == src[i]) continue;
+			shadow[start + i] = src[i];
+			dirty_sectors |= (uint64_t)1 << ADDR_TO_SECTOR(start + i);
+		}
+		return;
+	}
+	last = start + len - 1;
+	// gather the changed bytes of each sector, then update it once
+	for (group = start >> 2; group <= (last >> 2) && group < (start >> 2) + FLASH_SECTORS; group++) {
+		uint32_t sector = group % FLASH_SECTORS;
+		if (!shadow) sector_read(sector, image);
+		count = 0;
+		for (g = group; g <= (last >> 2); g += FLASH_SECTORS) {
+			for (i = 0; i < 4; i++) {
+				uint32_t a = (g << 2) | i;
+				if (a < start || a > last) continue;
+				uint32_t offset = ADDR_TO_OFFSET(a);
+				uint8_t data = src[a - start];
+				if (data == (shadow ? shadow[a] : image[offset])) continue;
+				entries[count++] = offset | (data << 8);
+			}
+		}
+		if (count == 0) continue;
+		//printf("ee_wr, sector=%u, count=%u, len=%u\n",
+			//sector, count, sector_index[sector]);
+		sector_write(sector, entries, count);
+		if (shadow) {
+			for (i = 0; i < count; i++) {
+				shadow[SECTOR_TO_ADDR(sector, entries[i] & 255)] = entries[i] >> 8;
+			}
+		}
 	}
 }
 
 
 
-
+#if !defined(EEPROM_HOST_SIMULATION)
 
 #define LUT0(opcode, pads, operand) (FLEXSPI_LUT_INSTRUCTION((opcode), (pads), (operand)))
 #define LUT1(opcode, pads, operand) (FLEXSPI_LUT_INSTRUCTION((opcode), (pads), (operand)) << 16)
@@ -355,3 +503,5 @@ void eepromemu_flash_erase_64K_block(void *addr)
 	FLEXSPI_INTR = FLEXSPI_INTR_IPCMDDONE;
 	flash_wait();
 }
+
+#endif // EEPROM_HOST_SIMULATION
@@ -204,7 +204,7 @@ char * dtostrf(float val, int width, unsigned int precision, char *buf)
 			s = fcvtf(val, newPrecision, &newDecimalPoint, &sign);
 
 			// if rounded up to new digit (e.g. 0.09 to 0.1), move decimal point
-			if (newDecimalPoint - decpt == precision + 1) decpt++;
+			if (newDecimalPoint - decpt == (int)precision + 1) decpt++;
 		}
 	}
 
@@ -250,3 +250,111 @@ char * dtostrf(float val, int width, unsigned int precision, char *buf)
 	return buf;
 }
 
+
+// Format val with exactly precision digits after the decimal point,
+// correctly rounded (ties to even, the same as printf).  The binary
+// value is converted exactly with integer math, rather than repeatedly
+// multiplying by 10.0, which accumulates error.  precision is limited
+// to 17.  buf must hold at least 40 bytes.  Returns the length, or 0
+// without writing buf if val is nan, inf, or too large for 64 bits.
+int dtoa_fixed(double val, unsigned int precision, char *buf)
+{
+	union { double d; uint64_t u; } bits = { .d = val };
+	uint64_t mant = bits.u & 0x000FFFFFFFFFFFFFull;
+	int exp = (bits.u >> 52) & 0x7FF;
+	uint64_t ipart, fpart = 0;
+	uint32_t frac[4] = {0, 0, 0, 0}; // 4.124 fixed point, frac[3] = MSW
+	char digits[17], tmp[20];
+	unsigned int i, k = 0;
+	int n;
+	char *p = buf;
+
+	if (exp == 0x7FF) return 0;
+	if (precision > sizeof(digits)) precision = sizeof(digits);
+	if (exp == 0) {
+		exp = -1074;	// subnormal
+	} else {
+		mant |= 0x0010000000000000ull;
+		exp -= 1075;
+	}
+	// val = mant * 2^exp, split into integer and fraction parts
+	if (exp >= 0) {
+		if (exp > 11) return 0;
+		ipart = mant << exp;
+	} else {
+		k = -exp;
+		if (k < 64) {
+			ipart = mant >> k;
+			fpart = mant & ((1ull << k) - 1);
+		} else {
+			ipart = 0;
+			fpart = mant;
+		}
+	}
+	// fpart / 2^k becomes frac / 2^124.  Fractions needing more than 124
+	// bits are below 2^-71, which always round to zero.
+	if (fpart && k <= 124) {
+		unsigned int shift = 124 - k, word = shift >> 5, bit = shift & 31;
+		uint32_t lo = fpart, hi = fpart >> 32;
+		uint32_t t[3];
+		t[0] = lo << bit;
+		t[1] = (hi << bit) | (bit ? lo >> (32 - bit) : 0);
+		t[2] = bit ? hi >> (32 - bit) : 0;
+		for (i=0; i < 3 && i + word < 4; i++) {
+			frac[i + word] = t[i];
+		}
+	}
+	// each fraction digit is the 4 bits above the binary point after
+	// multiplying by 10
+	for (i=0; i < precision; i++) {
+		uint32_t carry = 0;
+		for (int j=0; j < 4; j++) {
+			uint64_t t = (uint64_t)frac[j] * 10 + carry;
+			frac[j] = t;
+			carry = t >> 32;
+		}
+		digits[i] = '0' + (frac[3] >> 28);
+		frac[3] &= 0x0FFFFFFF;
+	}
+	// round the remainder against one half
+	int up = 0;
+	if (frac[3] > 0x08000000) {
+		up = 1;
+	} else if (frac[3] == 0x08000000) {
+		if (frac[2] | frac[1] | frac[0]) {
+			up = 1;
+		} else {
+			up = (precision > 0) ? (digits[precision - 1] & 1) : (ipart & 1);
+		}
+	}
+	if (up) {
+		for (i=precision; i > 0; i--) {
+			if (digits[i - 1] != '9') break;
+			digits[i - 1] = '0';
+		}
+		if (i > 0) {
+			digits[i - 1]++;
+		} else if (++ipart == 0) {
+			return 0;
+		}
+	}
+	if (bits.u >> 63) *p++ = '-'; // sign bit, so -0.0 is "-0", like printf
+	n = 0;
+	while (ipart > 0xFFFFFFFF) {
+		tmp[n++] = '0' + ipart % 10;
+		ipart /= 10;
+	}
+	uint32_t ipart32 = ipart;
+	do {
+		tmp[n++] = '0' + ipart32 % 10;
+		ipart32 /= 10;
+	} while (ipart32);
+	while (n > 0) *p++ = tmp[--n];
+	if (precision > 0) {
+		*p++ = '.';
+		memcpy(p, digits, precision);
+		p += precision;
+	}
+	*p = 0;
+	return p - buf;
+}
@@ -0,0 +1,182 @@
+/*
+ * This file is a part of SMalloc.
+ * SMalloc is MIT licensed.
+ * Copyright (c) 2017 Andrey Rys.
+ */
+
+#include "smalloc_i.h"
+
+/*
+ * Free block index. Every free block is a contiguous run of memory
+ * which starts with struct smalloc_free and ends with struct smalloc_ftr.
+ * Adjacent free blocks are always merged, so a free block never has
+ * a free neighbour. Lists are selected by a two level size mapping,
+ * and two bitmaps tell which lists are non-empty, so finding a fitting
+ * block takes constant time regardless of how fragmented the pool is.
+ */
+
+static uintptr_t smalloc_mkfreetag(struct smalloc_free *sfree)
+{
+	uintptr_t r = smalloc_uinthash(PTR_UINT(sfree));
+	r ^= sfree->size;
+	r = smalloc_uinthash(r);
+	return ~r;
+}
+
+static int smalloc_fls(size_t x)
+{
+	return (int)(sizeof(unsigned long) * CHAR_BIT) - 1 - __builtin_clzl(x);
+}
+
+static void smalloc_mapping(size_t size, int *fl, int *sl)
+{
+	size_t u = size / HEADER_SZ;
+	int f = smalloc_fls(u);
+
+	if (f < SMALLOC_SL_SHIFT) {
+		*sl = (int)(u << (SMALLOC_SL_SHIFT - f)) & (SMALLOC_SL_COUNT - 1);
+	} else {
+		*sl = (int)(u >> (f - SMALLOC_SL_SHIFT)) & (SMALLOC_SL_COUNT - 1);
+	}
+	*fl = f;
+}
+
+void smalloc_init_index(struct smalloc_pool *spool)
+{
+	spool->fl_bitmap = 0;
+	memset(spool->sl_bitmap, 0, sizeof(spool->sl_bitmap));
+	memset(spool->free_lists, 0, sizeof(spool->free_lists));
+	if (spool->pool_size >= MIN_FREE_SZ)
+		smalloc_insert_free(spool, spool->pool, spool->pool_size);
+}
+
+int smalloc_is_free(struct smalloc_pool *spool, void *p)
+{
+	struct smalloc_free *sfree = FREE_PTR(p);
+
+	if (CHAR_PTR(p) < CHAR_PTR(spool->pool)) return 0;
+	if (CHAR_PTR(p) + MIN_FREE_SZ > CHAR_PTR(spool->pool) + spool->pool_size) return 0;
+	if (sfree->size < MIN_FREE_SZ) return 0;
+	if (sfree->size % HEADER_SZ) return 0;
+	if (sfree->size > (size_t)(CHAR_PTR(spool->pool) + spool->pool_size - CHAR_PTR(p))) return 0;
+	if (sfree->tag != smalloc_mkfreetag(sfree)) return 0;
+	return 1;
+}
+
+void smalloc_insert_free(struct smalloc_pool *spool, void *p, size_t size)
+{
+	struct smalloc_free *sfree = FREE_PTR(p);
+	struct smalloc_ftr *sftr;
+	int fl, sl;
+
+	sfree->size = size;
+	sfree->tag = smalloc_mkfreetag(sfree);
+	sftr = (struct smalloc_ftr *)(CHAR_PTR(p) + size - sizeof(struct smalloc_ftr));
+	sftr->size = size;
+	sftr->tag = sfree->tag;
+
+	smalloc_mapping(size, &fl, &sl);
+	sfree->prev = NULL;
+	sfree->next = spool->free_lists[fl][sl];
+	if (sfree->next) sfree->next->prev = sfree;
+	spool->free_lists[fl][sl] = sfree;
+	spool->sl_bitmap[fl] |= (1u << sl);
+	spool->fl_bitmap |= (1u << fl);
+}
+
+void smalloc_remove_free(struct smalloc_pool *spool, struct smalloc_free *sfree)
+{
+	int fl, sl;
+
+	smalloc_mapping(sfree->size, &fl, &sl);
+	if (sfree->next) sfree->next->prev = sfree->prev;
+	if (sfree->prev) {
+		sfree->prev->next = sfree->next;
+	} else {
+		spool->free_lists[fl][sl] = sfree->next;
+		if (!sfree->next) {
+			spool->sl_bitmap[fl] &= ~(1u << sl);
+			if (!spool->sl_bitmap[fl]) spool->fl_bitmap &= ~(1u << fl);
+		}
+	}
+	/* a stale header inside allocated or merged memory must never validate */
+	sfree->tag = 0;
+}
+
+/*
+ * Find, unlink and return a free block of at least size bytes.
+ * The request is rounded up to the next list boundary, so the
+ * first block of any non-empty list at or above it is big enough.
+ * Only if that fails, the list the request itself maps to is searched,
+ * so that an allocation close to the size of the largest free block
+ * still succeeds.
+ */
+struct smalloc_free *smalloc_find_free(struct smalloc_pool *spool, size_t size)
+{
+	struct smalloc_free *sfree;
+	uint32_t sl_map, fl_map;
+	int fl, sl;
+	size_t x;
+
+	fl = smalloc_fls(size / HEADER_SZ);
+	x = size;
+	if (fl >= SMALLOC_SL_SHIFT) x += ((size_t)HEADER_SZ << (fl - SMALLOC_SL_SHIFT)) - HEADER_SZ;
+	smalloc_mapping(x, &fl, &sl);
+	if (fl >= SMALLOC_FL_COUNT) goto exact;
+
+	sl_map = spool->sl_bitmap[fl] & (~0u << sl);
+	if (!sl_map) {
+		if (fl + 1 >= SMALLOC_FL_COUNT) goto exact;
+		fl_map = spool->fl_bitmap & (~0u << (fl + 1));
+		if (!fl_map) goto exact;
+		fl = __builtin_ctz(fl_map);
+		sl_map = spool->sl_bitmap[fl];
+	}
+	sl = __builtin_ctz(sl_map);
+
+	sfree = spool->free_lists[fl][sl];
+	smalloc_remove_free(spool, sfree);
+	return sfree;
+
+exact:	smalloc_mapping(size, &fl, &sl);
+	if (fl >= SMALLOC_FL_COUNT) return NULL;
+	for (sfree = spool->free_lists[fl][sl]; sfree; sfree = sfree->next) {
+		if (sfree->size >= size) {
+			smalloc_remove_free(spool, sfree);
+			return sfree;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Return a run of memory which is no longer allocated to the index,
+ * merging it with free neighbours on both sides.
+ */
+void smalloc_release_block(struct smalloc_pool *spool, void *p, size_t size)
+{
+	struct smalloc_free *sfree;
+	struct smalloc_ftr *sftr;
+	char *s = CHAR_PTR(p);
+
+	if (smalloc_is_free(spool, s + size)) {
+		sfree = FREE_PTR(s + size);
+		size += sfree->size;
+		smalloc_remove_free(spool, sfree);
+	}
+
+	if (s - CHAR_PTR(spool->pool) >= (ptrdiff_t)MIN_FREE_SZ) {
+		sftr = (struct smalloc_ftr *)(s - sizeof(struct smalloc_ftr));
+		if (sftr->size <= (size_t)(s - CHAR_PTR(spool->pool))
+		&& smalloc_is_free(spool, s - sftr->size)
+		&& FREE_PTR(s - sftr->size)->size == sftr->size) {
+			sfree = FREE_PTR(s - sftr->size);
+			s = CHAR_PTR(sfree);
+			size += sfree->size;
+			smalloc_remove_free(spool, sfree);
+		}
+	}
+
+	/* a lone header sized gap can only be reclaimed by a later merge */
+	if (size >= MIN_FREE_SZ) smalloc_insert_free(spool, s, size);
+}
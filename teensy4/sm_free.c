@@ -10,6 +10,7 @@ void sm_free_pool(struct smalloc_pool *spool, void *p)
 {
 	struct smalloc_hdr *shdr;
 	char *s;
+	size_t size;
 
 	if (!smalloc_verify_pool(spool)) {
 		errno = EINVAL;
@@ -20,12 +21,14 @@ void sm_free_pool(struct smalloc_pool *spool, void *p)
 
 	shdr = USER_TO_HEADER(p);
 	if (smalloc_is_alloc(spool, shdr)) {
+		size = BLOCK_SZ(shdr->rsz);
 		if (spool->do_zero) memset(p, 0, shdr->rsz);
 		s = CHAR_PTR(p);
 		s += shdr->usz;
 		memset(s, 0, HEADER_SZ);
 		if (spool->do_zero) memset(s+HEADER_SZ, 0, shdr->rsz - shdr->usz);
 		memset(shdr, 0, HEADER_SZ);
+		smalloc_release_block(spool, shdr, size);
 		return;
 	}
 
@@ -8,10 +8,9 @@
 
 void *sm_malloc_pool(struct smalloc_pool *spool, size_t n)
 {
-	struct smalloc_hdr *basehdr, *shdr, *dhdr;
-	char *s;
-	int found;
-	size_t x;
+	struct smalloc_hdr *shdr;
+	struct smalloc_free *sfree;
+	size_t rsz, x;
 
 again:	if (!smalloc_verify_pool(spool)) {
 		errno = EINVAL;
@@ -22,79 +21,37 @@ again:	if (!smalloc_verify_pool(spool)) {
 	if (n > SIZE_MAX
 	|| n > (spool->pool_size - HEADER_SZ)) goto oom;
 
-	shdr = basehdr = spool->pool;
-	while (CHAR_PTR(shdr)-CHAR_PTR(basehdr) < spool->pool_size) {
-		/*
-		 * Already allocated block.
-		 * Skip it by jumping over it.
-		 */
-		if (smalloc_is_alloc(spool, shdr)) {
-			s = CHAR_PTR(HEADER_TO_USER(shdr));
-			s += shdr->rsz + HEADER_SZ;
-			shdr = HEADER_PTR(s);
-			continue;
-		}
-		/*
-		 * Free blocks ahead!
-		 * Do a second search over them to find out if they're
-		 * really large enough to fit the new allocation.
-		 */
-		else {
-			dhdr = shdr; found = 0;
-			while (CHAR_PTR(dhdr)-CHAR_PTR(basehdr) < spool->pool_size) {
-				/* pre calculate free block size */
-				x = CHAR_PTR(dhdr)-CHAR_PTR(shdr);
-				/*
-				 * ugh, found next allocated block.
-				 * skip this candidate then.
-				 */
-				if (smalloc_is_alloc(spool, dhdr))
-					goto allocblock;
-				/*
-				 * did not see allocated block yet,
-				 * but this free block is of enough size
-				 * - finally, use it.
-				 */
-				if (n + HEADER_SZ <= x) {
-					x -= HEADER_SZ;
-					found = 1;
-					goto outfound;
-				}
-				dhdr++;
-			}
-
-outfound:		if (found) {
-				uintptr_t tag;
-				/* allocate and return this block */
-				shdr->rsz = x;
-				shdr->usz = n;
-				shdr->tag = tag = smalloc_mktag(shdr);
-				if (spool->do_zero) memset(HEADER_TO_USER(shdr), 0, shdr->rsz);
-				s = CHAR_PTR(HEADER_TO_USER(shdr));
-				s += shdr->usz;
-				for (x = 0;
-				x < sizeof(struct smalloc_hdr);
-				x += sizeof(uintptr_t)) {
-					tag = smalloc_uinthash(tag);
-					memcpy(s+x, &tag, sizeof(uintptr_t));
-				}
-				memset(s+x, 0xff, shdr->rsz - shdr->usz);
-				return HEADER_TO_USER(shdr);
-			}
+	/* user size rounded up to whole headers */
+	rsz = (n%HEADER_SZ)?(((n/HEADER_SZ)+1)*HEADER_SZ):n;
+	sfree = smalloc_find_free(spool, BLOCK_SZ(rsz));
+	if (!sfree) goto oom;
 
-			/* continue first search for next free block */
-allocblock:		shdr = dhdr;
-			continue;
-		}
-
-		shdr++;
+	/*
+	 * Split off the tail if it is big enough to be a free block,
+	 * otherwise hand the whole free block to this allocation.
+	 */
+	x = sfree->size;
+	if (x - BLOCK_SZ(rsz) >= MIN_FREE_SZ) {
+		smalloc_insert_free(spool, CHAR_PTR(sfree) + BLOCK_SZ(rsz), x - BLOCK_SZ(rsz));
+	} else {
+		rsz = x - HEADER_SZ*2;
 	}
 
+	shdr = HEADER_PTR(sfree);
+	if (spool->do_zero) memset(HEADER_TO_USER(shdr), 0, rsz);
+	smalloc_mkalloc(spool, shdr, rsz, n);
+	return HEADER_TO_USER(shdr);
+
 oom:	if (spool->oomfn) {
 		x = spool->oomfn(spool, n);
 		if (x > spool->pool_size) {
+			rsz = spool->pool_size;
 			spool->pool_size = x;
-			if (sm_align_pool(spool)) goto again;
+			if (sm_align_pool(spool)) {
+				/* index the newly added memory, merging with a free tail */
+				smalloc_release_block(spool, CHAR_PTR(spool->pool) + rsz, spool->pool_size - rsz);
+				goto again;
+			}
 		}
 	}
 
@@ -24,12 +24,19 @@ int sm_malloc_stats_pool(struct smalloc_pool *spool, size_t *total, size_t *user
 	if (nr_blocks) *nr_blocks = 0;
 
 	shdr = basehdr = spool->pool;
-	while (CHAR_PTR(shdr)-CHAR_PTR(basehdr) < spool->pool_size) {
+	while ((size_t)(CHAR_PTR(shdr)-CHAR_PTR(basehdr)) < spool->pool_size) {
 		if (smalloc_is_alloc(spool, shdr)) {
 			if (total) *total += HEADER_SZ + shdr->rsz + HEADER_SZ;
 			if (user) *user += shdr->usz;
 			if (nr_blocks) *nr_blocks += 1;
 			r = 1;
+			shdr += BLOCK_SZ(shdr->rsz)/HEADER_SZ;
+			continue;
+		}
+		/* skip over indexed free blocks as a whole */
+		if (smalloc_is_free(spool, shdr)) {
+			shdr += FREE_PTR(shdr)->size/HEADER_SZ;
+			continue;
 		}
 
 		shdr++;
@@ -58,6 +58,7 @@ int sm_set_pool(struct smalloc_pool *spool, void *new_pool, size_t new_pool_size
 		spool->do_zero = do_zero;
 		memset(spool->pool, 0, spool->pool_size);
 	}
+	smalloc_init_index(spool);
 
 	return 1;
 }
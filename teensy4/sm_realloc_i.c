@@ -13,12 +13,11 @@
  */
 void *sm_realloc_pool_i(struct smalloc_pool *spool, void *p, size_t n, int nomove)
 {
-	struct smalloc_hdr *basehdr, *shdr, *dhdr;
+	struct smalloc_hdr *shdr;
+	struct smalloc_free *sfree;
 	void *r;
 	char *s;
-	int found;
-	size_t rsz, usz, x;
-	uintptr_t tag;
+	size_t rsz, usz, nrsz, x;
 
 	if (!smalloc_verify_pool(spool)) {
 		errno = EINVAL;
@@ -36,24 +35,21 @@ void *sm_realloc_pool_i(struct smalloc_pool *spool, void *p, size_t n, int nomov
 	if (!smalloc_is_alloc(spool, shdr)) smalloc_UB(spool, p);
 	usz = shdr->usz;
 	rsz = shdr->rsz;
+	if (n > spool->pool_size) goto allocblock;
+	nrsz = (n%HEADER_SZ)?(((n/HEADER_SZ)+1)*HEADER_SZ):n;
 
 	/* newsize is lesser than allocated - truncate */
 	if (n <= usz) {
-		if (spool->do_zero) memset(p + n, 0, shdr->rsz - n);
 		s = CHAR_PTR(HEADER_TO_USER(shdr));
-		s += usz;
-		memset(s, 0, HEADER_SZ);
-		if (spool->do_zero) memset(s+HEADER_SZ, 0, rsz - usz);
-		shdr->rsz = (n%HEADER_SZ)?(((n/HEADER_SZ)+1)*HEADER_SZ):n;
-		shdr->usz = n;
-		shdr->tag = tag = smalloc_mktag(shdr);
-		s = CHAR_PTR(HEADER_TO_USER(shdr));
-		s += shdr->usz;
-		for (x = 0; x < sizeof(struct smalloc_hdr); x += sizeof(uintptr_t)) {
-			tag = smalloc_uinthash(tag);
-			memcpy(s+x, &tag, sizeof(uintptr_t));
+		if (spool->do_zero) memset(s + n, 0, rsz + HEADER_SZ - n);
+		else memset(s + usz, 0, HEADER_SZ);
+		/* give back the tail if it is big enough to be a free block */
+		if (rsz - nrsz >= MIN_FREE_SZ) {
+			smalloc_mkalloc(spool, shdr, nrsz, n);
+			smalloc_release_block(spool, s + nrsz + HEADER_SZ, rsz - nrsz);
+		} else {
+			smalloc_mkalloc(spool, shdr, rsz, n);
 		}
-		memset(s+x, 0xff, shdr->rsz - shdr->usz);
 		return p;
 	}
 
@@ -61,54 +57,24 @@ void *sm_realloc_pool_i(struct smalloc_pool *spool, void *p, size_t n, int nomov
 	if (n > usz && n <= rsz) {
 		if (spool->do_zero) {
 			s = CHAR_PTR(HEADER_TO_USER(shdr));
-			s += usz;
-			memset(s, 0, HEADER_SZ);
-		}
-		shdr->usz = n;
-		shdr->tag = tag = smalloc_mktag(shdr);
-		s = CHAR_PTR(HEADER_TO_USER(shdr));
-		s += shdr->usz;
-		for (x = 0; x < sizeof(struct smalloc_hdr); x += sizeof(uintptr_t)) {
-			tag = smalloc_uinthash(tag);
-			memcpy(s+x, &tag, sizeof(uintptr_t));
+			memset(s + usz, 0, n - usz);
 		}
-		memset(s+x, 0xff, shdr->rsz - shdr->usz);
+		smalloc_mkalloc(spool, shdr, rsz, n);
 		return p;
 	}
 
-	/* newsize is bigger, larger than rsz but there are free blocks beyond - extend */
-	basehdr = spool->pool; dhdr = shdr+(rsz/HEADER_SZ); found = 0;
-	while (CHAR_PTR(dhdr)-CHAR_PTR(basehdr) < spool->pool_size) {
-		x = CHAR_PTR(dhdr)-CHAR_PTR(shdr);
-		if (smalloc_is_alloc(spool, dhdr))
-			goto allocblock;
-		if (n + HEADER_SZ <= x) {
-			x -= HEADER_SZ;
-			found = 1;
-			goto outfound;
-		}
-		dhdr++;
-	}
-
-outfound:
-	/* write new numbers of same allocation */
-	if (found) {
-		if (spool->do_zero) {
-			s = CHAR_PTR(HEADER_TO_USER(shdr));
-			s += usz;
-			memset(s, 0, HEADER_SZ);
-			memset(s+HEADER_SZ, 0, rsz - usz);
-		}
-		shdr->rsz = x;
-		shdr->usz = n;
-		shdr->tag = tag = smalloc_mktag(shdr);
+	/* newsize is bigger, larger than rsz but there is a free block beyond - extend */
+	s = CHAR_PTR(shdr) + BLOCK_SZ(rsz);
+	if (smalloc_is_free(spool, s) && rsz + FREE_PTR(s)->size >= nrsz) {
+		sfree = FREE_PTR(s);
+		x = rsz + sfree->size;
+		smalloc_remove_free(spool, sfree);
+		if (x - nrsz < MIN_FREE_SZ) nrsz = x;
 		s = CHAR_PTR(HEADER_TO_USER(shdr));
-		s += shdr->usz;
-		for (x = 0; x < sizeof(struct smalloc_hdr); x += sizeof(uintptr_t)) {
-			tag = smalloc_uinthash(tag);
-			memcpy(s+x, &tag, sizeof(uintptr_t));
-		}
-		memset(s+x, 0xff, shdr->rsz - shdr->usz);
+		if (spool->do_zero) memset(s + usz, 0, n - usz);
+		smalloc_mkalloc(spool, shdr, nrsz, n);
+		/* the block after the old free one is allocated, no merge needed */
+		if (x > nrsz) smalloc_insert_free(spool, s + nrsz + HEADER_SZ, x - nrsz);
 		return p;
 	}
 
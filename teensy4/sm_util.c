@@ -63,3 +63,22 @@ int smalloc_is_alloc(struct smalloc_pool *spool, struct smalloc_hdr *shdr)
 	if (!smalloc_valid_tag(shdr)) return 0;
 	return 1;
 }
+
+/* write header and trailing tag area of an allocation, user data is left alone */
+void smalloc_mkalloc(struct smalloc_pool *spool __attribute__((unused)), struct smalloc_hdr *shdr, size_t rsz, size_t usz)
+{
+	uintptr_t tag;
+	char *s;
+	size_t x;
+
+	shdr->rsz = rsz;
+	shdr->usz = usz;
+	shdr->tag = tag = smalloc_mktag(shdr);
+	s = CHAR_PTR(HEADER_TO_USER(shdr));
+	s += shdr->usz;
+	for (x = 0; x < sizeof(struct smalloc_hdr); x += sizeof(uintptr_t)) {
+		tag = smalloc_uinthash(tag);
+		memcpy(s+x, &tag, sizeof(uintptr_t));
+	}
+	memset(s+x, 0xff, shdr->rsz - shdr->usz);
+}
@@ -32,15 +32,29 @@ extern "C" {
 #endif
 
 struct smalloc_pool;
+struct smalloc_free;
 
 typedef size_t (*smalloc_oom_handler)(struct smalloc_pool *, size_t);
 
+/*
+ * Free blocks are kept in segregated lists (two level, TLSF style):
+ * first level is log2 of the block size in headers, second level
+ * splits each power of two range into SMALLOC_SL_COUNT classes.
+ */
+#define SMALLOC_FL_COUNT 32
+#define SMALLOC_SL_SHIFT 2
+#define SMALLOC_SL_COUNT (1 << SMALLOC_SL_SHIFT)
+
 /* describes static pool, if you're going to use multiple pools at same time */
 struct smalloc_pool {
 	void *pool; /* pointer to your pool */
 	size_t pool_size; /* it's size. Must be aligned with sm_align_pool. */
 	int do_zero; /* zero pool before use and all the new allocations from it. */
 	smalloc_oom_handler oomfn; /* this will be called, if non-NULL, on OOM condition in pool */
+	/* free block index, maintained by sm_set_pool, malloc, free and realloc */
+	uint32_t fl_bitmap;
+	uint32_t sl_bitmap[SMALLOC_FL_COUNT];
+	struct smalloc_free *free_lists[SMALLOC_FL_COUNT][SMALLOC_SL_COUNT];
 };
 
 /* a default one which is initialised with sm_set_default_pool. */
@@ -22,8 +22,29 @@ struct smalloc_hdr {
 	uintptr_t tag; /* sum of all the above, hashed value */
 };
 
+/*
+ * Header of a free block. Lives in the first bytes of the free space
+ * and is mirrored by a smalloc_ftr in the last bytes, so both neighbours
+ * of a freed allocation can be found without scanning the pool.
+ */
+struct smalloc_free {
+	size_t size; /* whole free block size, multiple of HEADER_SZ */
+	struct smalloc_free *next;
+	struct smalloc_free *prev;
+	uintptr_t tag; /* hashed address and size, differs from allocated tags */
+};
+
+struct smalloc_ftr {
+	size_t size;
+	uintptr_t tag;
+};
+
 #define HEADER_SZ (sizeof(struct smalloc_hdr))
 #define MIN_POOL_SZ (HEADER_SZ*20)
+/* smallest free block: must hold a smalloc_free and a smalloc_ftr */
+#define MIN_FREE_SZ (HEADER_SZ*2)
+/* an allocation spends a header in front and a tag area behind user data */
+#define BLOCK_SZ(rsz) (HEADER_SZ + (rsz) + HEADER_SZ)
 
 #define VOID_PTR(p) ((void *)p)
 #define CHAR_PTR(p) ((char *)p)
@@ -31,6 +52,7 @@ struct smalloc_hdr {
 #define HEADER_PTR(p) ((struct smalloc_hdr *)p)
 #define USER_TO_HEADER(p) (HEADER_PTR((CHAR_PTR(p)-HEADER_SZ)))
 #define HEADER_TO_USER(p) (VOID_PTR((CHAR_PTR(p)+HEADER_SZ)))
+#define FREE_PTR(p) ((struct smalloc_free *)(p))
 
 extern smalloc_ub_handler smalloc_UB;
 
@@ -38,6 +60,14 @@ uintptr_t smalloc_uinthash(uintptr_t x);
 uintptr_t smalloc_mktag(struct smalloc_hdr *shdr);
 int smalloc_verify_pool(struct smalloc_pool *spool);
 int smalloc_is_alloc(struct smalloc_pool *spool, struct smalloc_hdr *shdr);
+void smalloc_mkalloc(struct smalloc_pool *spool, struct smalloc_hdr *shdr, size_t rsz, size_t usz);
+
+void smalloc_init_index(struct smalloc_pool *spool);
+int smalloc_is_free(struct smalloc_pool *spool, void *p);
+struct smalloc_free *smalloc_find_free(struct smalloc_pool *spool, size_t size);
+void smalloc_remove_free(struct smalloc_pool *spool, struct smalloc_free *sfree);
+void smalloc_insert_free(struct smalloc_pool *spool, void *p, size_t size);
+void smalloc_release_block(struct smalloc_pool *spool, void *p, size_t size);
 
 void *sm_realloc_pool_i(struct smalloc_pool *spool, void *p, size_t n, int nomove);
 
@@ -927,6 +927,38 @@ void usb_prepare_transfer(transfer_t *transfer, const void *data, uint32_t len,
 	transfer->callback_param = param;
 }
 
+// The most bytes one transfer starting at data can move.  Its 5 page
+// pointers cover 20K, less the offset of data within the first page.
+uint32_t usb_transfer_max_length(const void *data)
+{
+	return 20480 - ((uint32_t)data & 4095);
+}
+
+// Prepare up to count transfers, linked together, to move len bytes at data.
+// Each is as long as usb_transfer_max_length() allows, rounded down to a
+// multiple of packet_size, so only the last may end with a short packet.
+// Returns how many transfers were used, or 0 if count is not enough.
+// Schedule the chain with usb_transmit_chain() or usb_receive_chain().
+uint32_t usb_prepare_transfer_chain(transfer_t *transfer, uint32_t count,
+	const void *data, uint32_t len, uint32_t packet_size, uint32_t param)
+{
+	const uint8_t *p = (const uint8_t *)data;
+	uint32_t n = 0;
+
+	do {
+		if (n >= count) return 0;
+		uint32_t max = usb_transfer_max_length(p);
+		max -= max % packet_size;
+		uint32_t size = (len < max) ? len : max;
+		usb_prepare_transfer(transfer + n, p, size, param);
+		if (n > 0) transfer[n - 1].next = (uint32_t)(transfer + n);
+		n++;
+		p += size;
+		len -= size;
+	} while (len > 0);
+	return n;
+}
+
 #if 0
 void usb_print_transfer_log(void)
 {
@@ -944,14 +976,16 @@ void usb_print_transfer_log(void)
 }
 #endif
 
-static void schedule_transfer(endpoint_t *endpoint, uint32_t epmask, transfer_t *transfer)
+// Add transfers first to last, already linked together, to an endpoint's
+// queue.  Only the last one interrupts, so the callback runs once for all.
+static void schedule_transfer(endpoint_t *endpoint, uint32_t epmask, transfer_t *transfer, transfer_t *last_in_chain)
 {
 	// when we stop at 6, why is the last transfer missing from the USB output?
 	//if (transfer_log_count >= 6) return;
 
 	//uint32_t ret = (*(const uint8_t *)transfer->pointer0) << 8;
 	if (endpoint->callback_function) {
-		transfer->status |= (1<<15);
+		last_in_chain->status |= (1<<15);
 	}
 	__disable_irq();
 	//digitalWriteFast(1, HIGH);
@@ -981,7 +1015,7 @@ static void schedule_transfer(endpoint_t *endpoint, uint32_t epmask, transfer_t
 	USB1_ENDPTPRIME |= epmask;
 	endpoint->first_transfer = transfer;
 end:
-	endpoint->last_transfer = transfer;
+	endpoint->last_transfer = last_in_chain;
 	__enable_irq();
 	//digitalWriteFast(4, LOW);
 	//digitalWriteFast(3, LOW);
@@ -1058,10 +1092,10 @@ static void run_callbacks(endpoint_t *ep)
 			break;
 		}
 	}
-	// do all the callbacks
+	// do all the callbacks, once per chain (only its last transfer has IOC)
 	while (count) {
 		transfer_t *next = (transfer_t *)first->next;
-		ep->callback_function(first);
+		if (first->status & (1<<15)) ep->callback_function(first);
 		first = next;
 		count--;
 	}
@@ -1072,7 +1106,18 @@ void usb_transmit(int endpoint_number, transfer_t *transfer)
 	if (endpoint_number < 2 || endpoint_number > NUM_ENDPOINTS) return;
 	endpoint_t *endpoint = endpoint_queue_head + endpoint_number * 2 + 1;
 	uint32_t mask = 1 << (endpoint_number + 16);
-	schedule_transfer(endpoint, mask, transfer);
+	schedule_transfer(endpoint, mask, transfer, transfer);
+}
+
+// Transmit a chain made by usb_prepare_transfer_chain().  It is complete
+// when usb_transfer_status() of its last transfer is no longer active.
+void usb_transmit_chain(int endpoint_number, transfer_t *transfer, uint32_t count)
+{
+	if (endpoint_number < 2 || endpoint_number > NUM_ENDPOINTS) return;
+	if (count == 0) return;
+	endpoint_t *endpoint = endpoint_queue_head + endpoint_number * 2 + 1;
+	uint32_t mask = 1 << (endpoint_number + 16);
+	schedule_transfer(endpoint, mask, transfer, transfer + count - 1);
 }
 
 void usb_receive(int endpoint_number, transfer_t *transfer)
@@ -1080,7 +1125,20 @@ void usb_receive(int endpoint_number, transfer_t *transfer)
 	if (endpoint_number < 2 || endpoint_number > NUM_ENDPOINTS) return;
 	endpoint_t *endpoint = endpoint_queue_head + endpoint_number * 2;
 	uint32_t mask = 1 << endpoint_number;
-	schedule_transfer(endpoint, mask, transfer);
+	schedule_transfer(endpoint, mask, transfer, transfer);
+}
+
+// Receive into a chain made by usb_prepare_transfer_chain().  A short
+// packet completes only the transfer it lands in, and the rest of the
+// chain stays queued for the next data, so use this only when the host
+// will send exactly the chain's length.
+void usb_receive_chain(int endpoint_number, transfer_t *transfer, uint32_t count)
+{
+	if (endpoint_number < 2 || endpoint_number > NUM_ENDPOINTS) return;
+	if (count == 0) return;
+	endpoint_t *endpoint = endpoint_queue_head + endpoint_number * 2;
+	uint32_t mask = 1 << endpoint_number;
+	schedule_transfer(endpoint, mask, transfer, transfer + count - 1);
 }
 
 uint32_t usb_transfer_status(const transfer_t *transfer)
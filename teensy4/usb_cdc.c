@@ -0,0 +1,507 @@
+/* Teensyduino Core Library
+ * http://www.pjrc.com/teensy/
+ * Copyright (c) 2017 PJRC.COM, LLC.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * 1. The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * 2. If the Software is incorporated into a build system that allows
+ * selection among a list of target devices, then similar target
+ * devices manufactured by PJRC.COM must be included in the list of
+ * target devices and selectable in the same manner.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "usb_dev.h"
+#include "usb_cdc.h"
+#include "core_pins.h" // for yield()
+#include <string.h> // for memcpy()
+
+#include "debug/printf.h"
+
+// defined by usb_dev.h -> usb_desc.h
+#if defined(CDC_DATA_INTERFACE) || defined(CDC2_DATA_INTERFACE) || defined(CDC3_DATA_INTERFACE)
+
+extern volatile uint8_t usb_high_speed;
+extern volatile uint32_t systick_millis_count;
+
+static void rx_queue_transfer(usb_cdc_port_t *port, int i);
+
+void usb_cdc_configure(usb_cdc_port_t *port)
+{
+	int i;
+
+	if (usb_high_speed) {
+		port->tx_packet_size = CDC_TX_SIZE_480;
+		port->rx_packet_size = CDC_RX_SIZE_480;
+	} else {
+		port->tx_packet_size = CDC_TX_SIZE_12;
+		port->rx_packet_size = CDC_RX_SIZE_12;
+	}
+	memset(port->tx_transfer, 0, port->tx_num * sizeof(transfer_t));
+	memset(port->tx_user_buffer, 0, port->tx_num * sizeof(const void *));
+	port->tx_head = 0;
+	port->tx_available = 0;
+	memset(port->rx_transfer, 0, port->rx_num * sizeof(transfer_t));
+	memset(port->rx_count, 0, port->rx_num * sizeof(uint16_t));
+	memset(port->rx_index, 0, port->rx_num * sizeof(uint16_t));
+	port->rx_head = 0;
+	port->rx_tail = 0;
+	port->rx_available = 0;
+	usb_config_tx(port->acm_endpoint, CDC_ACM_SIZE, 0, NULL); // size same 12 & 480
+	usb_config_rx(port->rx_endpoint, port->rx_packet_size, 0, port->rx_event);
+	usb_config_tx(port->tx_endpoint, port->tx_packet_size, 1, NULL);
+	for (i=0; i < port->rx_num; i++) rx_queue_transfer(port, i);
+}
+
+
+/*************************************************************************/
+/**                               Receive                               **/
+/*************************************************************************/
+
+static void rx_queue_transfer(usb_cdc_port_t *port, int i)
+{
+	NVIC_DISABLE_IRQ(IRQ_USB1);
+	printf("rx queue i=%d\n", i);
+	void *buffer = port->rx_buffer + i * CDC_RX_SIZE_480;
+	usb_prepare_transfer(port->rx_transfer + i, buffer, port->rx_packet_size, i);
+	arm_dcache_delete(buffer, port->rx_packet_size);
+	usb_receive(port->rx_endpoint, port->rx_transfer + i);
+	NVIC_ENABLE_IRQ(IRQ_USB1);
+}
+
+// called by USB interrupt when any packet is received
+void usb_cdc_rx_event(usb_cdc_port_t *port, transfer_t *t)
+{
+	int len = port->rx_packet_size - ((t->status >> 16) & 0x7FFF);
+	int i = t->callback_param;
+	printf("rx event, len=%d, i=%d\n", len, i);
+	if (len > 0) {
+		// received a packet with data
+		uint32_t head = port->rx_head;
+		if (head != port->rx_tail) {
+			// a previous packet is still buffered
+			uint32_t ii = port->rx_list[head];
+			uint32_t count = port->rx_count[ii];
+			if (len <= CDC_RX_SIZE_480 - count) {
+				// previous buffer has enough free space for this packet's data
+				memcpy(port->rx_buffer + ii * CDC_RX_SIZE_480 + count,
+					port->rx_buffer + i * CDC_RX_SIZE_480, len);
+				port->rx_count[ii] = count + len;
+				port->rx_available += len;
+				rx_queue_transfer(port, i);
+				// TODO: trigger serialEvent
+				return;
+			}
+		}
+		// add this packet to rx_list
+		port->rx_count[i] = len;
+		port->rx_index[i] = 0;
+		if (++head > port->rx_num) head = 0;
+		port->rx_list[head] = i;
+		port->rx_head = head;
+		port->rx_available += len;
+		// TODO: trigger serialEvent
+	} else {
+		// received a zero length packet
+		rx_queue_transfer(port, i);
+	}
+}
+
+// read a block of bytes to a buffer
+int usb_cdc_read(usb_cdc_port_t *port, void *buffer, uint32_t size)
+{
+	uint8_t *p = (uint8_t *)buffer;
+	uint32_t count=0;
+
+	NVIC_DISABLE_IRQ(IRQ_USB1);
+	uint32_t tail = port->rx_tail;
+	//printf("usb_cdc_read, size=%d, tail=%d, head=%d\n", size, tail, port->rx_head);
+	while (count < size && tail != port->rx_head) {
+		if (++tail > port->rx_num) tail = 0;
+		uint32_t i = port->rx_list[tail];
+		uint32_t len = size - count;
+		uint32_t avail = port->rx_count[i] - port->rx_index[i];
+		if (avail > len) {
+			// partially consume this packet
+			memcpy(p, port->rx_buffer + i * CDC_RX_SIZE_480 + port->rx_index[i], len);
+			port->rx_available -= len;
+			port->rx_index[i] += len;
+			count += len;
+		} else {
+			// fully consume this packet
+			memcpy(p, port->rx_buffer + i * CDC_RX_SIZE_480 + port->rx_index[i], avail);
+			p += avail;
+			port->rx_available -= avail;
+			count += avail;
+			port->rx_tail = tail;
+			rx_queue_transfer(port, i);
+		}
+	}
+	NVIC_ENABLE_IRQ(IRQ_USB1);
+	return count;
+}
+
+// Zero copy receive.  Returns a pointer to the unread data of the oldest
+// received packet, and its length, or NULL if nothing received.  The data
+// stays valid until usb_cdc_read_release(), which consumes size bytes
+// and gives the packet's buffer back to USB once all of it was consumed.
+const void * usb_cdc_read_borrow(usb_cdc_port_t *port, uint32_t *size)
+{
+	const void *p = NULL;
+	*size = 0;
+	NVIC_DISABLE_IRQ(IRQ_USB1);
+	uint32_t tail = port->rx_tail;
+	if (tail != port->rx_head) {
+		if (++tail > port->rx_num) tail = 0;
+		uint32_t i = port->rx_list[tail];
+		*size = port->rx_count[i] - port->rx_index[i];
+		p = port->rx_buffer + i * CDC_RX_SIZE_480 + port->rx_index[i];
+	}
+	NVIC_ENABLE_IRQ(IRQ_USB1);
+	return p;
+}
+
+void usb_cdc_read_release(usb_cdc_port_t *port, uint32_t size)
+{
+	NVIC_DISABLE_IRQ(IRQ_USB1);
+	uint32_t tail = port->rx_tail;
+	if (tail != port->rx_head) {
+		if (++tail > port->rx_num) tail = 0;
+		uint32_t i = port->rx_list[tail];
+		uint32_t avail = port->rx_count[i] - port->rx_index[i];
+		if (size < avail) {
+			port->rx_available -= size;
+			port->rx_index[i] += size;
+		} else {
+			port->rx_available -= avail;
+			port->rx_tail = tail;
+			rx_queue_transfer(port, i);
+		}
+	}
+	NVIC_ENABLE_IRQ(IRQ_USB1);
+}
+
+// peek at the next character, or -1 if nothing received
+int usb_cdc_peekchar(usb_cdc_port_t *port)
+{
+	uint32_t tail = port->rx_tail;
+	if (tail == port->rx_head) return -1;
+	if (++tail > port->rx_num) tail = 0;
+	uint32_t i = port->rx_list[tail];
+	return port->rx_buffer[i * CDC_RX_SIZE_480 + port->rx_index[i]];
+}
+
+// number of bytes available in the receive buffer
+int usb_cdc_available(usb_cdc_port_t *port)
+{
+	uint32_t n = port->rx_available;
+	if (n == 0) yield();
+	return n;
+}
+
+// discard any buffered input
+void usb_cdc_flush_input(usb_cdc_port_t *port)
+{
+	uint32_t tail = port->rx_tail;
+	while (tail != port->rx_head) {
+		if (++tail > port->rx_num) tail = 0;
+		uint32_t i = port->rx_list[tail];
+		port->rx_available -= port->rx_count[i] - port->rx_index[i];
+		rx_queue_transfer(port, i);
+		port->rx_tail = tail;
+	}
+}
+
+
+/*************************************************************************/
+/**                               Transmit                              **/
+/*************************************************************************/
+
+
+// When the PC isn't listening, how long do we wait before discarding data?  If this is
+// too short, we risk losing data during the stalls that are common with ordinary desktop
+// software.  If it's too long, we stall the user's program when no software is running.
+#define TX_TIMEOUT_MSEC 120
+
+// Range of the flush delay chosen by USB_SERIAL_FLUSH_ADAPTIVE, in microseconds
+#define ADAPTIVE_TIMEOUT_MIN  20
+#define ADAPTIVE_TIMEOUT_MAX  1000
+
+// Wait for the transfer at tx_head to finish, so its buffer can be filled.
+// Called with tx_noautoflush set.  Returns 0 if we gave up waiting.
+//
+// When we've suffered the transmit timeout, don't wait again until the computer
+// begins accepting data.  If no software is running to receive, we'll just discard
+// data as rapidly as Serial.print() can generate it, until there's something to
+// actually receive it.
+static int tx_wait(usb_cdc_port_t *port)
+{
+	transfer_t *xfer = port->tx_transfer + port->tx_head;
+	int waiting=0;
+	uint32_t wait_begin_at=0;
+	while (!port->tx_available) {
+		uint32_t status = usb_transfer_status(xfer);
+		if (!(status & 0x80)) {
+			if (status & 0x68) {
+				// TODO: what if status has errors???
+				printf("ERROR status = %x, i=%d, ms=%u\n",
+					status, port->tx_head, systick_millis_count);
+			}
+			port->tx_available = port->tx_size;
+			port->tx_user_buffer[port->tx_head] = NULL;
+			port->transmit_previous_timeout = 0;
+			break;
+		}
+		asm("dsb" ::: "memory");
+		port->tx_noautoflush = 0;
+		if (!waiting) {
+			wait_begin_at = systick_millis_count;
+			waiting = 1;
+		}
+		if (port->transmit_previous_timeout) return 0;
+		if (systick_millis_count - wait_begin_at > TX_TIMEOUT_MSEC) {
+			// waited too long, assume the USB host isn't listening
+			port->transmit_previous_timeout = 1;
+			return 0;
+		}
+		if (!usb_configuration) return 0;
+		yield();
+		port->tx_noautoflush = 1;
+	}
+	return 1;
+}
+
+// Transmit the first txnum bytes of the buffer at tx_head
+static void tx_queue_current(usb_cdc_port_t *port, uint32_t txnum)
+{
+	transfer_t *xfer = port->tx_transfer + port->tx_head;
+	uint8_t *txbuf = port->tx_buffer + (port->tx_head * port->tx_size);
+	usb_prepare_transfer(xfer, txbuf, txnum, 0);
+	arm_dcache_flush_delete(txbuf, txnum);
+	usb_transmit(port->tx_endpoint, xfer);
+	if (++port->tx_head >= port->tx_num) port->tx_head = 0;
+	port->tx_available = 0;
+	port->tx_packet_count += (txnum + port->tx_packet_size - 1) / port->tx_packet_size;
+	port->tx_byte_count += txnum;
+}
+
+// Called with tx_noautoflush set, after len bytes at data were added to
+// the partly filled buffer at tx_head.  Sends it now or starts the flush
+// timer, according to the port's flush policy.
+static void tx_flush_schedule(usb_cdc_port_t *port, const void *data, uint32_t len)
+{
+	uint32_t used = port->tx_size - port->tx_available;
+
+	switch (port->flush_policy) {
+	  case USB_SERIAL_FLUSH_NEWLINE:
+		if (!memchr(data, '\n', len)) break;
+		tx_queue_current(port, used);
+		port->timer_stop();
+		return;
+	  case USB_SERIAL_FLUSH_THRESHOLD:
+		if (used < port->flush_threshold) break;
+		tx_queue_current(port, used);
+		port->timer_stop();
+		return;
+	  case USB_SERIAL_FLUSH_ADAPTIVE: {
+		// Wait a little longer than the usual time between writes, so
+		// a burst of small writes goes out together.  If writes are
+		// too far apart for that to help, don't make them wait.
+		uint32_t now = micros();
+		uint32_t gap = now - port->write_last_us;
+		port->write_last_us = now;
+		if (gap > ADAPTIVE_TIMEOUT_MAX) gap = ADAPTIVE_TIMEOUT_MAX;
+		port->write_gap_avg += ((int32_t)gap - (int32_t)port->write_gap_avg) / 8;
+		uint32_t timeout = port->write_gap_avg * 2;
+		if (timeout > ADAPTIVE_TIMEOUT_MAX || timeout < ADAPTIVE_TIMEOUT_MIN) {
+			timeout = ADAPTIVE_TIMEOUT_MIN;
+		}
+		port->timer_start_oneshot(timeout);
+		return;
+	  }
+	}
+	port->timer_start_oneshot(port->flush_timeout);
+}
+
+int usb_cdc_write(usb_cdc_port_t *port, const void *buffer, uint32_t size)
+{
+	uint32_t sent=0;
+	const uint8_t *data = (const uint8_t *)buffer;
+
+	if (!usb_configuration) return 0;
+	while (size > 0) {
+		port->tx_noautoflush = 1;
+		if (!tx_wait(port)) return sent;
+		uint32_t avail = port->tx_available;
+		uint8_t *txdata = port->tx_buffer + (port->tx_head * port->tx_size)
+			+ (port->tx_size - avail);
+		if (size >= avail) {
+			memcpy(txdata, data, avail);
+			size -= avail;
+			sent += avail;
+			data += avail;
+			tx_queue_current(port, port->tx_size);
+			port->timer_stop();
+		} else {
+			memcpy(txdata, data, size);
+			port->tx_available = avail - size;
+			sent += size;
+			tx_flush_schedule(port, txdata, size);
+			size = 0;
+		}
+		asm("dsb" ::: "memory");
+		port->tx_noautoflush = 0;
+	}
+	return sent;
+}
+
+// Zero copy transmit.  Returns a pointer to the free space in the current
+// transmit buffer, and its size.  Write your data there, then call
+// usb_cdc_write_commit() with the number of bytes written.  Nothing is
+// transmitted, even by the automatic flush, until the commit.  Returns
+// NULL with size 0 if the PC isn't receiving.
+void * usb_cdc_write_acquire(usb_cdc_port_t *port, uint32_t *size)
+{
+	*size = 0;
+	if (!usb_configuration) return NULL;
+	port->tx_noautoflush = 1;
+	if (!tx_wait(port)) return NULL;
+	*size = port->tx_available;
+	return port->tx_buffer + (port->tx_head * port->tx_size)
+		+ (port->tx_size - port->tx_available);
+}
+
+void usb_cdc_write_commit(usb_cdc_port_t *port, uint32_t size)
+{
+	if (size > port->tx_available) size = port->tx_available;
+	const uint8_t *data = port->tx_buffer + (port->tx_head * port->tx_size)
+		+ (port->tx_size - port->tx_available);
+	port->tx_available -= size;
+	if (size > 0 && port->tx_available == 0) {
+		tx_queue_current(port, port->tx_size);
+		port->timer_stop();
+	} else if (port->tx_available > 0 && port->tx_available < port->tx_size) {
+		tx_flush_schedule(port, data, size);
+	}
+	asm("dsb" ::: "memory");
+	port->tx_noautoflush = 0;
+}
+
+// Transmit directly from the caller's buffer, without copying.  Data
+// already written is sent first.  The buffer must not be changed until
+// usb_cdc_write_pending() returns 0 for it.
+int usb_cdc_write_submit(usb_cdc_port_t *port, const void *buffer, uint32_t size)
+{
+	uint32_t sent=0;
+	const uint8_t *data = (const uint8_t *)buffer;
+
+	if (!usb_configuration) return 0;
+	port->tx_noautoflush = 1;
+	if (port->tx_available > 0 && port->tx_available < port->tx_size) {
+		tx_queue_current(port, port->tx_size - port->tx_available);
+	}
+	port->timer_stop();
+	while (size > 0) {
+		uint32_t max = usb_transfer_max_length(data);
+		max -= max % port->tx_packet_size;
+		uint32_t len = (size < max) ? size : max;
+		if (!tx_wait(port)) return sent;
+		transfer_t *xfer = port->tx_transfer + port->tx_head;
+		usb_prepare_transfer(xfer, data, len, 0);
+		arm_dcache_flush((void *)data, len);
+		port->tx_user_buffer[port->tx_head] = buffer;
+		usb_transmit(port->tx_endpoint, xfer);
+		if (++port->tx_head >= port->tx_num) port->tx_head = 0;
+		port->tx_available = 0;
+		port->tx_packet_count += (len + port->tx_packet_size - 1) / port->tx_packet_size;
+		port->tx_byte_count += len;
+		data += len;
+		size -= len;
+		sent += len;
+	}
+	asm("dsb" ::: "memory");
+	port->tx_noautoflush = 0;
+	return sent;
+}
+
+// Is USB still transmitting from a buffer given to usb_cdc_write_submit()?
+int usb_cdc_write_pending(usb_cdc_port_t *port, const void *buffer)
+{
+	for (uint32_t i=0; i < port->tx_num; i++) {
+		if (port->tx_user_buffer[i] == buffer
+		  && (usb_transfer_status(port->tx_transfer + i) & 0x80)) return 1;
+	}
+	return 0;
+}
+
+int usb_cdc_write_buffer_free(usb_cdc_port_t *port)
+{
+	uint32_t sum = 0;
+	port->tx_noautoflush = 1;
+	for (uint32_t i=0; i < port->tx_num; i++) {
+		if (i == port->tx_head) continue;
+		if (!(usb_transfer_status(port->tx_transfer + i) & 0x80)) sum += port->tx_size;
+	}
+	asm("dsb" ::: "memory");
+	port->tx_noautoflush = 0;
+	return sum;
+}
+
+void usb_cdc_flush_output(usb_cdc_port_t *port)
+{
+	if (!usb_configuration) return;
+	if (port->tx_available == 0) return;
+	port->tx_noautoflush = 1;
+	tx_queue_current(port, port->tx_size - port->tx_available);
+	asm("dsb" ::: "memory");
+	port->tx_noautoflush = 0;
+}
+
+// called by the port's flush timer interrupt
+void usb_cdc_flush_callback(usb_cdc_port_t *port)
+{
+	if (port->tx_noautoflush) return;
+	if (!usb_configuration) return;
+	if (port->tx_available == 0) return;
+	//printf("flush callback, %d bytes\n", port->tx_size - port->tx_available);
+	tx_queue_current(port, port->tx_size - port->tx_available);
+}
+
+// Choose when partly filled buffers are sent.  value is the delay in
+// microseconds for USB_SERIAL_FLUSH_DELAY, or the number of bytes for
+// USB_SERIAL_FLUSH_THRESHOLD.  0 keeps the previous setting.  NEWLINE and
+// THRESHOLD fall back to the DELAY timeout when they don't send at once.
+void usb_cdc_set_flush_policy(usb_cdc_port_t *port, uint8_t policy, uint32_t value)
+{
+	if (policy > USB_SERIAL_FLUSH_ADAPTIVE) return;
+	if (value > 0) {
+		if (policy == USB_SERIAL_FLUSH_DELAY) {
+			// 5 ms is the longest the quad timer used by port 3 can count
+			port->flush_timeout = (value < 5000) ? value : 5000;
+		} else if (policy == USB_SERIAL_FLUSH_THRESHOLD) {
+			port->flush_threshold = (value < port->tx_size) ? value : port->tx_size;
+		}
+	}
+	port->write_gap_avg = port->flush_timeout;
+	port->write_last_us = micros();
+	port->flush_policy = policy;
+}
+
+#endif // CDC_DATA_INTERFACE || CDC2_DATA_INTERFACE || CDC3_DATA_INTERFACE
@@ -0,0 +1,159 @@
+/* Teensyduino Core Library
+ * http://www.pjrc.com/teensy/
+ * Copyright (c) 2017 PJRC.COM, LLC.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * 1. The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * 2. If the Software is incorporated into a build system that allows
+ * selection among a list of target devices, then similar target
+ * devices manufactured by PJRC.COM must be included in the list of
+ * target devices and selectable in the same manner.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// CDC-ACM virtual serial engine, shared by usb_serial.c, usb_serial2.c and
+// usb_serial3.c.  Each port file defines its buffers and state with
+// USB_CDC_PORT() and passes that port to these functions.  Not intended
+// for use by Arduino sketches.
+
+#ifndef usb_cdc_h_
+#define usb_cdc_h_
+
+#include "usb_dev.h"
+#include "usb_serial.h" // for USB_SERIAL_FLUSH_*
+#include "avr/pgmspace.h" // for DMAMEM
+
+// At very slow CPU speeds, the OCRAM just isn't fast enough for
+// USB to work reliably.  But the precious/limited DTCM is.  So
+// as an ugly workaround, undefine DMAMEM so all buffers which
+// would normally be allocated in OCRAM are placed in DTCM.
+#if defined(F_CPU) && F_CPU < 30000000
+#undef DMAMEM
+#define DMAMEM
+#endif
+
+#if !defined(USB_DISABLED)
+
+typedef struct {
+	// fixed by USB_CDC_PORT()
+	uint8_t acm_endpoint;
+	uint8_t rx_endpoint;
+	uint8_t tx_endpoint;
+	uint8_t tx_num;
+	uint8_t rx_num;
+	uint16_t tx_size;
+	transfer_t *tx_transfer;
+	uint8_t *tx_buffer;
+	const void **tx_user_buffer;
+	transfer_t *rx_transfer;
+	uint8_t *rx_buffer;
+	uint16_t *rx_count;
+	uint16_t *rx_index;
+	uint8_t *rx_list;
+	void (*rx_event)(transfer_t *t);
+	void (*timer_start_oneshot)(uint32_t microseconds);
+	void (*timer_stop)(void);
+	// flush policy, see usb_cdc_set_flush_policy()
+	uint8_t flush_policy;
+	uint16_t flush_timeout;
+	uint16_t flush_threshold;
+	uint16_t write_gap_avg;
+	uint32_t write_last_us;
+	// statistics
+	volatile uint32_t tx_packet_count;
+	volatile uint32_t tx_byte_count;
+	// runtime state
+	volatile uint8_t tx_noautoflush;
+	uint8_t tx_head;
+	uint8_t transmit_previous_timeout;
+	uint16_t tx_available;
+	uint16_t tx_packet_size;
+	uint16_t rx_packet_size;
+	volatile uint8_t rx_head;
+	volatile uint8_t rx_tail;
+	volatile uint32_t rx_available;
+} usb_cdc_port_t;
+
+// Define the buffers and state for a port named "name".  It gets tx_num
+// transmit buffers of tx_size bytes, which should be a multiple of 512 and
+// at most 16384, and rx_num receive packet buffers.  Deep queues suit high
+// bandwidth ports, shallow ones save memory on console ports.  rx_event
+// must call usb_cdc_rx_event() for this port.  timerstart must start (or
+// restart) a one-shot timer which calls usb_cdc_flush_callback() after the
+// given number of microseconds, initially flushtimeout.
+#define USB_CDC_PORT(name, acm_ep, rx_ep, tx_ep, txnum, txsize, rxnum, rxevent, timerstart, timerstop, flushtimeout) \
+	static transfer_t name##_tx_transfer[txnum] __attribute__ ((used, aligned(32))); \
+	DMAMEM static uint8_t name##_tx_buffer[(txsize) * (txnum)] __attribute__ ((aligned(32))); \
+	static const void *name##_tx_user_buffer[txnum]; \
+	static transfer_t name##_rx_transfer[rxnum] __attribute__ ((used, aligned(32))); \
+	DMAMEM static uint8_t name##_rx_buffer[(rxnum) * CDC_RX_SIZE_480] __attribute__ ((aligned(32))); \
+	static uint16_t name##_rx_count[rxnum]; \
+	static uint16_t name##_rx_index[rxnum]; \
+	static uint8_t name##_rx_list[(rxnum) + 1]; \
+	static usb_cdc_port_t name = { \
+		.acm_endpoint = (acm_ep), \
+		.rx_endpoint = (rx_ep), \
+		.tx_endpoint = (tx_ep), \
+		.tx_num = (txnum), \
+		.rx_num = (rxnum), \
+		.tx_size = (txsize), \
+		.tx_transfer = name##_tx_transfer, \
+		.tx_buffer = name##_tx_buffer, \
+		.tx_user_buffer = name##_tx_user_buffer, \
+		.rx_transfer = name##_rx_transfer, \
+		.rx_buffer = name##_rx_buffer, \
+		.rx_count = name##_rx_count, \
+		.rx_index = name##_rx_index, \
+		.rx_list = name##_rx_list, \
+		.rx_event = (rxevent), \
+		.timer_start_oneshot = (timerstart), \
+		.timer_stop = (timerstop), \
+		.flush_policy = USB_SERIAL_FLUSH_DELAY, \
+		.flush_timeout = (flushtimeout), \
+		.flush_threshold = CDC_TX_SIZE_480, \
+		.write_gap_avg = (flushtimeout), \
+	}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void usb_cdc_configure(usb_cdc_port_t *port);
+void usb_cdc_rx_event(usb_cdc_port_t *port, transfer_t *t);
+int usb_cdc_read(usb_cdc_port_t *port, void *buffer, uint32_t size);
+const void * usb_cdc_read_borrow(usb_cdc_port_t *port, uint32_t *size);
+void usb_cdc_read_release(usb_cdc_port_t *port, uint32_t size);
+int usb_cdc_peekchar(usb_cdc_port_t *port);
+int usb_cdc_available(usb_cdc_port_t *port);
+void usb_cdc_flush_input(usb_cdc_port_t *port);
+int usb_cdc_write(usb_cdc_port_t *port, const void *buffer, uint32_t size);
+void * usb_cdc_write_acquire(usb_cdc_port_t *port, uint32_t *size);
+void usb_cdc_write_commit(usb_cdc_port_t *port, uint32_t size);
+int usb_cdc_write_submit(usb_cdc_port_t *port, const void *buffer, uint32_t size);
+int usb_cdc_write_pending(usb_cdc_port_t *port, const void *buffer);
+int usb_cdc_write_buffer_free(usb_cdc_port_t *port);
+void usb_cdc_flush_output(usb_cdc_port_t *port);
+void usb_cdc_flush_callback(usb_cdc_port_t *port);
+void usb_cdc_set_flush_policy(usb_cdc_port_t *port, uint8_t policy, uint32_t value);
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !USB_DISABLED
+#endif
@@ -28,8 +28,13 @@ void usb_config_rx_iso(uint32_t ep, uint32_t packet_size, int mult, void (*cb)(t
 void usb_config_tx_iso(uint32_t ep, uint32_t packet_size, int mult, void (*cb)(transfer_t *));
 
 void usb_prepare_transfer(transfer_t *transfer, const void *data, uint32_t len, uint32_t param);
+uint32_t usb_transfer_max_length(const void *data);
+uint32_t usb_prepare_transfer_chain(transfer_t *transfer, uint32_t count,
+	const void *data, uint32_t len, uint32_t packet_size, uint32_t param);
 void usb_transmit(int endpoint_number, transfer_t *transfer);
 void usb_receive(int endpoint_number, transfer_t *transfer);
+void usb_transmit_chain(int endpoint_number, transfer_t *transfer, uint32_t count);
+void usb_receive_chain(int endpoint_number, transfer_t *transfer, uint32_t count);
 uint32_t usb_transfer_status(const transfer_t *transfer);
 
 void usb_start_sof_interrupts(int interface);
@@ -40,13 +40,14 @@
 
 extern volatile uint8_t usb_high_speed;
 
-#define TX_NUM   4
+#define TX_NUM   8
 static transfer_t tx_transfer[TX_NUM] __attribute__ ((used, aligned(32)));
 DMAMEM static uint8_t txbuffer[MTP_TX_SIZE_480 * TX_NUM] __attribute__ ((aligned(32)));
+static const void *tx_user_buffer[TX_NUM]; // for usb_mtp_send_submit()
 static uint8_t tx_head=0;
 static uint16_t tx_packet_size=0;
 
-#define RX_NUM  4
+#define RX_NUM  8
 static transfer_t rx_transfer[RX_NUM] __attribute__ ((used, aligned(32)));
 DMAMEM static uint8_t rx_buffer[MTP_RX_SIZE_480 * RX_NUM] __attribute__ ((aligned(32)));
 static volatile uint8_t rx_head;
@@ -80,6 +81,7 @@ void usb_mtp_configure(void)
 	}
 	printf("usb_mtp_configure: TX:%u RX:%u\n", tx_packet_size, rx_packet_size);
 	memset(tx_transfer, 0, sizeof(tx_transfer));
+	memset(tx_user_buffer, 0, sizeof(tx_user_buffer));
 	memset(rx_transfer, 0, sizeof(rx_transfer));
 	tx_head = 0;
 	rx_head = 0;
@@ -159,6 +161,37 @@ int usb_mtp_recv(void *buffer, uint32_t timeout)
 	return len;
 }
 
+// Receive several packets at once.  Copies whole packets to buffer until
+// len is full, or a short packet ends the data phase, or no packet arrives
+// for timeout milliseconds.  len should be a multiple of usb_mtp_rxSize().
+// Returns the number of bytes received, or -1 if USB isn't configured.
+int usb_mtp_recv_multi(void *buffer, uint32_t len, uint32_t timeout)
+{
+	uint8_t *p = (uint8_t *)buffer;
+	uint32_t count = 0;
+	uint32_t wait_begin_at = systick_millis_count;
+	uint32_t tail = rx_tail;
+
+	while (count + rx_packet_size <= len) {
+		if (!usb_configuration) return (count > 0) ? (int)count : -1;
+		if (tail == rx_head) {
+			if (systick_millis_count - wait_begin_at >= timeout) break;
+			yield();
+			continue;
+		}
+		if (++tail > RX_NUM) tail = 0;
+		uint32_t i = rx_list[tail];
+		int n = rx_list_transfer_len[tail];
+		rx_tail = tail;
+		memcpy(p + count, rx_buffer + i * MTP_RX_SIZE_480, n);
+		rx_queue_transfer(i);
+		count += n;
+		if (n < rx_packet_size) break; // short packet, end of data
+		wait_begin_at = systick_millis_count;
+	}
+	return count;
+}
+
 int usb_mtp_available(void)
 {
 	if (!usb_configuration) return 0;
@@ -170,7 +203,9 @@ int usb_mtp_available(void)
 /*************************************************************************/
 /**                             Send                                    **/
 /*************************************************************************/
-int usb_mtp_send(const void *buffer, uint32_t len, uint32_t timeout)
+// Wait for the transfer at tx_head to finish, so it can be reused.
+// Returns 1 when ready, 0 on timeout, -1 if USB isn't configured.
+static int tx_wait(uint32_t timeout)
 {
 	transfer_t *xfer = tx_transfer + tx_head;
 	uint32_t wait_begin_at = systick_millis_count;
@@ -182,6 +217,15 @@ int usb_mtp_send(const void *buffer, uint32_t len, uint32_t timeout)
 		if (systick_millis_count - wait_begin_at > timeout) return 0;
 		yield();
 	}
+	tx_user_buffer[tx_head] = NULL;
+	return 1;
+}
+
+int usb_mtp_send(const void *buffer, uint32_t len, uint32_t timeout)
+{
+	int r = tx_wait(timeout);
+	if (r <= 0) return r;
+	transfer_t *xfer = tx_transfer + tx_head;
 	uint8_t *txdata = txbuffer + (tx_head * MTP_TX_SIZE_480);
 	memcpy(txdata, buffer, len);
 	arm_dcache_flush_delete(txdata, tx_packet_size );
@@ -191,4 +235,45 @@ int usb_mtp_send(const void *buffer, uint32_t len, uint32_t timeout)
 	return len;
 }
 
+// Transmit directly from the caller's buffer, without copying, as up to
+// TX_NUM transfers of up to 20K queued at once.  Every part of a data phase
+// except the last must be a multiple of usb_mtp_txSize(), because a
+// short packet tells the host the data has ended.  The buffer must not
+// change until usb_mtp_send_pending() returns 0 for it.  Returns the
+// number of bytes queued, 0 on timeout, or -1 if USB isn't configured.
+int usb_mtp_send_submit(const void *buffer, uint32_t len, uint32_t timeout)
+{
+	const uint8_t *data = (const uint8_t *)buffer;
+	uint32_t sent = 0;
+
+	while (len > 0) {
+		int r = tx_wait(timeout);
+		if (r <= 0) return (sent > 0) ? (int)sent : r;
+		uint32_t max = usb_transfer_max_length(data);
+		max -= max % tx_packet_size;
+		uint32_t n = (len < max) ? len : max;
+		transfer_t *xfer = tx_transfer + tx_head;
+		arm_dcache_flush((void *)data, n);
+		usb_prepare_transfer(xfer, data, n, 0);
+		tx_user_buffer[tx_head] = buffer;
+		usb_transmit(MTP_TX_ENDPOINT, xfer);
+		if (++tx_head >= TX_NUM) tx_head = 0;
+		data += n;
+		len -= n;
+		sent += n;
+	}
+	return sent;
+}
+
+// Is USB still transmitting from a buffer given to usb_mtp_send_submit()?
+// With NULL, is any transmit still in progress?
+int usb_mtp_send_pending(const void *buffer)
+{
+	for (uint32_t i=0; i < TX_NUM; i++) {
+		if ((buffer == NULL || tx_user_buffer[i] == buffer)
+		  && (usb_transfer_status(tx_transfer + i) & 0x80)) return 1;
+	}
+	return 0;
+}
+
 #endif // MTP_INTERFACE
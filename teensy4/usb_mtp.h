@@ -42,8 +42,11 @@ extern "C" {
 #endif
 void usb_mtp_configure(void);
 int usb_mtp_recv(void *buffer, uint32_t timeout);
+int usb_mtp_recv_multi(void *buffer, uint32_t len, uint32_t timeout);
 int usb_mtp_available(void);
 int usb_mtp_send(const void *buffer, uint32_t len, uint32_t timeout);
+int usb_mtp_send_submit(const void *buffer, uint32_t len, uint32_t timeout);
+int usb_mtp_send_pending(const void *buffer);
 int usb_mtp_rxSize(void);
 int usb_mtp_txSize(void);
 
@@ -63,6 +66,11 @@ public:
 	int available(void) {return usb_mtp_available(); }
 	int recv(void *buffer, uint32_t timeout) { return usb_mtp_recv(buffer, timeout); }
 	int send(const void *buffer, uint32_t len, uint32_t timeout) { return usb_mtp_send(buffer, len, timeout); }
+	// Streaming data phase: receive many packets per call, and transmit
+	// from your buffer without copying.  See usb_mtp.c for the rules.
+	int recvMulti(void *buffer, uint32_t len, uint32_t timeout) { return usb_mtp_recv_multi(buffer, len, timeout); }
+	int sendSubmit(const void *buffer, uint32_t len, uint32_t timeout) { return usb_mtp_send_submit(buffer, len, timeout); }
+	bool sendPending(const void *buffer=NULL) { return usb_mtp_send_pending(buffer); }
     int rxSize(void) {return usb_mtp_rxSize(); }
     int txSize(void) {return usb_mtp_txSize(); }
 
@@ -33,6 +33,12 @@
 #include "usb_desc.h"
 #include <stdint.h>
 
+// When partly filled transmit buffers are sent, for setFlushPolicy()
+#define USB_SERIAL_FLUSH_DELAY      0  // after value microseconds with no more writes (default 75)
+#define USB_SERIAL_FLUSH_NEWLINE    1  // at once if a write contains '\n', otherwise as DELAY
+#define USB_SERIAL_FLUSH_THRESHOLD  2  // at once when value bytes are buffered, otherwise as DELAY
+#define USB_SERIAL_FLUSH_ADAPTIVE   3  // after a delay tuned to how often you write
+
 #if (defined(CDC_STATUS_INTERFACE) && defined(CDC_DATA_INTERFACE)) || defined(USB_DISABLED)
 
 #if !defined(USB_DISABLED)
@@ -47,11 +53,20 @@ int usb_serial_getchar(void);
 int usb_serial_peekchar(void);
 int usb_serial_available(void);
 int usb_serial_read(void *buffer, uint32_t size);
+const void * usb_serial_read_borrow(uint32_t *size);
+void usb_serial_read_release(uint32_t size);
 void usb_serial_flush_input(void);
 int usb_serial_putchar(uint8_t c);
 int usb_serial_write(const void *buffer, uint32_t size);
+void * usb_serial_write_acquire(uint32_t *size);
+void usb_serial_write_commit(uint32_t size);
+int usb_serial_write_submit(const void *buffer, uint32_t size);
+int usb_serial_write_pending(const void *buffer);
 int usb_serial_write_buffer_free(void);
 void usb_serial_flush_output(void);
+void usb_serial_set_flush_policy(uint8_t policy, uint32_t value);
+uint32_t usb_serial_tx_packets(void);
+uint32_t usb_serial_tx_bytes(void);
 extern uint32_t usb_cdc_line_coding[2];
 extern volatile uint32_t usb_cdc_line_rtsdtr_millis;
 extern volatile uint32_t systick_millis_count;
@@ -111,6 +126,20 @@ public:
         virtual void flush() { usb_serial_flush_output(); }  // TODO: actually wait for data to leave USB...
 	// Discard all received data which has not been read.
         virtual void clear(void) { usb_serial_flush_input(); }
+	// Access received data in place, without copying.  Returns a pointer to
+	// the next unread data and sets size to how many bytes are there, or
+	// returns NULL if nothing has been received.  The data remains valid
+	// until readRelease(), which removes size bytes of it.
+	const void * readBorrow(uint32_t *size) { return usb_serial_read_borrow(size); }
+	void readRelease(uint32_t size) { usb_serial_read_release(size); }
+	// Stream's read-ahead window, which lets parseInt(), find() and
+	// readStringUntil() scan received packets in place.
+	virtual size_t readAhead(const uint8_t **data) {
+		uint32_t size;
+		*data = (const uint8_t *)usb_serial_read_borrow(&size);
+		return size;
+	}
+	virtual void consume(size_t count) { usb_serial_read_release(count); }
 	// Transmit a single byte to your PC
         virtual size_t write(uint8_t c) { return usb_serial_putchar(c); }
 	// Transmit a buffer containing any number of bytes to your PC
@@ -129,12 +158,33 @@ public:
 	// transmit.
 	virtual int availableForWrite() { return usb_serial_write_buffer_free(); }
 	using Print::write;
+	// Get a pointer to free space in the USB transmit buffer, to write data
+	// directly without copying.  size is set to the number of bytes which fit.
+	// Returns NULL when your PC isn't receiving.  Call writeCommit() when done.
+	void * writeAcquire(uint32_t *size) { return usb_serial_write_acquire(size); }
+	// Transmit the first size bytes written to the space from writeAcquire().
+	void writeCommit(uint32_t size) { usb_serial_write_commit(size); }
+	// Transmit directly from your buffer, without copying.  The buffer must
+	// not change until writePending() returns false.  Returns the number of
+	// bytes queued, which is less than size if your PC isn't receiving.
+	size_t writeSubmit(const void *buffer, size_t size) { return usb_serial_write_submit(buffer, size); }
+	// Returns true while a buffer given to writeSubmit() is still in use.
+	bool writePending(const void *buffer) { return usb_serial_write_pending(buffer); }
 	// Cause any previously transmitted data written to buffers to be actually
 	// sent over the USB cable to your PC as soon as possible.  Normally writes
 	// are combined to efficiently use maximum size USB packets.  Use of send_now()
 	// minimizes latency, but excessive use can lead to inefficient utilization
 	// of USB bandwidth.
         void send_now(void) { usb_serial_flush_output(); }
+	// Choose when data left in a partly filled buffer is sent, trading
+	// latency against USB bandwidth.  policy is USB_SERIAL_FLUSH_DELAY
+	// (value = microseconds, default 75), USB_SERIAL_FLUSH_NEWLINE,
+	// USB_SERIAL_FLUSH_THRESHOLD (value = bytes) or USB_SERIAL_FLUSH_ADAPTIVE.
+	void setFlushPolicy(uint8_t policy, uint32_t value=0) { usb_serial_set_flush_policy(policy, value); }
+	// Count USB packets and bytes transmitted, to see the effect of the
+	// flush policy.  bytesSent() / packetsSent() is the average packet size.
+	uint32_t packetsSent(void) { return usb_serial_tx_packets(); }
+	uint32_t bytesSent(void) { return usb_serial_tx_bytes(); }
 	// Returns the baud rate configuration set by PC software.  This setting is
 	// not used for USB communication.  You would typically call this function
 	// when making a USB to Serial converter, where you wish to know the baud
@@ -204,6 +254,8 @@ public:
         virtual int peek() { return -1; }
         virtual void flush() { }
         virtual void clear() { }
+    const void * readBorrow(uint32_t *size) { *size = 0; return NULL; }
+    void readRelease(uint32_t size) { }
         virtual size_t write(uint8_t c) { return 1; }
         virtual size_t write(const uint8_t *buffer, size_t size) { return size; }
     size_t write(unsigned long n) { return 1; }
@@ -212,7 +264,14 @@ public:
     size_t write(int n) { return 1; }
     virtual int availableForWrite() { return 0; }
     using Print::write;
+    void * writeAcquire(uint32_t *size) { *size = 0; return NULL; }
+    void writeCommit(uint32_t size) { }
+    size_t writeSubmit(const void *buffer, size_t size) { return size; }
+    bool writePending(const void *buffer) { return false; }
         void send_now(void) { }
+    void setFlushPolicy(uint8_t policy, uint32_t value=0) { }
+    uint32_t packetsSent(void) { return 0; }
+    uint32_t bytesSent(void) { return 0; }
         uint32_t baud(void) { return 0; }
         uint8_t stopbits(void) { return 1; }
         uint8_t paritytype(void) { return 0; }
@@ -243,11 +302,16 @@ int usb_serial2_getchar(void);
 int usb_serial2_peekchar(void);
 int usb_serial2_available(void);
 int usb_serial2_read(void *buffer, uint32_t size);
+const void * usb_serial2_read_borrow(uint32_t *size);
+void usb_serial2_read_release(uint32_t size);
 void usb_serial2_flush_input(void);
 int usb_serial2_putchar(uint8_t c);
 int usb_serial2_write(const void *buffer, uint32_t size);
 int usb_serial2_write_buffer_free(void);
 void usb_serial2_flush_output(void);
+void usb_serial2_set_flush_policy(uint8_t policy, uint32_t value);
+uint32_t usb_serial2_tx_packets(void);
+uint32_t usb_serial2_tx_bytes(void);
 extern uint32_t usb_cdc2_line_coding[2];
 extern volatile uint32_t usb_cdc2_line_rtsdtr_millis;
 extern volatile uint8_t usb_cdc2_line_rtsdtr;
@@ -283,6 +347,12 @@ public:
         virtual int peek() { return usb_serial2_peekchar(); }
         virtual void flush() { usb_serial2_flush_output(); }  // TODO: actually wait for data to leave USB...
         virtual void clear(void) { usb_serial2_flush_input(); }
+        virtual size_t readAhead(const uint8_t **data) {
+                uint32_t size;
+                *data = (const uint8_t *)usb_serial2_read_borrow(&size);
+                return size;
+        }
+        virtual void consume(size_t count) { usb_serial2_read_release(count); }
         virtual size_t write(uint8_t c) { return usb_serial2_putchar(c); }
         virtual size_t write(const uint8_t *buffer, size_t size) { return usb_serial2_write(buffer, size); }
         size_t write(unsigned long n) { return write((uint8_t)n); }
@@ -292,6 +362,9 @@ public:
         virtual int availableForWrite() { return usb_serial2_write_buffer_free(); }
         using Print::write;
         void send_now(void) { usb_serial2_flush_output(); }
+        void setFlushPolicy(uint8_t policy, uint32_t value=0) { usb_serial2_set_flush_policy(policy, value); }
+        uint32_t packetsSent(void) { return usb_serial2_tx_packets(); }
+        uint32_t bytesSent(void) { return usb_serial2_tx_bytes(); }
         uint32_t baud(void) { return usb_cdc2_line_coding[0]; }
         uint8_t stopbits(void) { uint8_t b = usb_cdc2_line_coding[1]; if (!b) b = 1; return b; }
         uint8_t paritytype(void) { return usb_cdc2_line_coding[1] >> 8; } // 0=none, 1=odd, 2=even
@@ -333,11 +406,16 @@ int usb_serial3_getchar(void);
 int usb_serial3_peekchar(void);
 int usb_serial3_available(void);
 int usb_serial3_read(void *buffer, uint32_t size);
+const void * usb_serial3_read_borrow(uint32_t *size);
+void usb_serial3_read_release(uint32_t size);
 void usb_serial3_flush_input(void);
 int usb_serial3_putchar(uint8_t c);
 int usb_serial3_write(const void *buffer, uint32_t size);
 int usb_serial3_write_buffer_free(void);
 void usb_serial3_flush_output(void);
+void usb_serial3_set_flush_policy(uint8_t policy, uint32_t value);
+uint32_t usb_serial3_tx_packets(void);
+uint32_t usb_serial3_tx_bytes(void);
 extern uint32_t usb_cdc3_line_coding[2];
 extern volatile uint32_t usb_cdc3_line_rtsdtr_millis;
 extern volatile uint8_t usb_cdc3_line_rtsdtr;
@@ -373,6 +451,12 @@ public:
         virtual int peek() { return usb_serial3_peekchar(); }
         virtual void flush() { usb_serial3_flush_output(); }  // TODO: actually wait for data to leave USB...
         virtual void clear(void) { usb_serial3_flush_input(); }
+        virtual size_t readAhead(const uint8_t **data) {
+                uint32_t size;
+                *data = (const uint8_t *)usb_serial3_read_borrow(&size);
+                return size;
+        }
+        virtual void consume(size_t count) { usb_serial3_read_release(count); }
         virtual size_t write(uint8_t c) { return usb_serial3_putchar(c); }
         virtual size_t write(const uint8_t *buffer, size_t size) { return usb_serial3_write(buffer, size); }
         size_t write(unsigned long n) { return write((uint8_t)n); }
@@ -382,6 +466,9 @@ public:
         virtual int availableForWrite() { return usb_serial3_write_buffer_free(); }
         using Print::write;
         void send_now(void) { usb_serial3_flush_output(); }
+        void setFlushPolicy(uint8_t policy, uint32_t value=0) { usb_serial3_set_flush_policy(policy, value); }
+        uint32_t packetsSent(void) { return usb_serial3_tx_packets(); }
+        uint32_t bytesSent(void) { return usb_serial3_tx_bytes(); }
         uint32_t baud(void) { return usb_cdc3_line_coding[0]; }
         uint8_t stopbits(void) { uint8_t b = usb_cdc3_line_coding[1]; if (!b) b = 1; return b; }
         uint8_t paritytype(void) { return usb_cdc3_line_coding[1] >> 8; } // 0=none, 1=odd, 2=even
@@ -28,47 +28,191 @@
  * SOFTWARE.
  */
 
+
 #include <Arduino.h>
 #include "EventResponder.h"
+#include "Fiber.h"
 
 uint8_t yield_active_check_flags = 0;
 
+// yield() runs the functions for each bit set in yield_active_check_flags,
+// lowest bit first.  YIELD_CHECK_HOOKS runs the functions registered with
+// yield_hook_add(), which are kept packed at the start of hooks[].
+
+struct yield_entry {
+	yield_hook_function_t function;
+	uint8_t busy;
+	struct yield_hook_stats stats;
+};
+
+static void yield_usb_serial(void)
+{
+#if !defined(USB_DISABLED)
+	if (Serial.available()) serialEvent();
+#endif
+}
+
+static void yield_hardware_serial(void)
+{
+	HardwareSerialIMXRT::processSerialEventsList();
+}
+
+static void yield_event_responder(void)
+{
+	EventResponder::runFromYield();
+}
+
+static void yield_usb_serialusb1(void)
+{
+#if defined(USB_DUAL_SERIAL) || defined(USB_TRIPLE_SERIAL)
+	if (SerialUSB1.available()) serialEventUSB1();
+#endif
+}
+
+static void yield_usb_serialusb2(void)
+{
+#ifdef USB_TRIPLE_SERIAL
+	if (SerialUSB2.available()) serialEventUSB2();
+#endif
+}
+
+static void yield_fibers(void)
+{
+	Fiber::runFromYield();
+}
+
+#define YIELD_BUILTIN_COUNT 6
+
+// in the same order as the YIELD_CHECK bits
+static struct yield_entry builtin[YIELD_BUILTIN_COUNT] = {
+	{yield_usb_serial, 0, {}},
+	{yield_hardware_serial, 0, {}},
+	{yield_event_responder, 0, {}},
+	{yield_usb_serialusb1, 0, {}},
+	{yield_usb_serialusb2, 0, {}},
+	{yield_fibers, 0, {}},
+};
+static struct yield_entry hooks[YIELD_HOOKS_MAX];
+static uint8_t hook_count = 0;
+static uint8_t hooks_running = 0; // yield()s running hooks, nested
+static bool hooks_removed = false; // hooks[] has empty entries
+static bool stats_enabled = false;
+
+static void yield_run(struct yield_entry *entry)
+{
+	// a function which calls yield() is not run again until it returns
+	if (entry->busy) return;
+	entry->busy = 1;
+	if (stats_enabled) {
+		uint32_t begin = ARM_DWT_CYCCNT;
+		entry->function();
+		uint32_t cycles = ARM_DWT_CYCCNT - begin;
+		entry->stats.calls++;
+		entry->stats.cycles += cycles;
+		if (cycles > entry->stats.max_cycles) entry->stats.max_cycles = cycles;
+	} else {
+		entry->function();
+	}
+	entry->busy = 0;
+}
+
+// remove empty entries, keeping the others in order
+static void yield_hooks_pack(void)
+{
+	uint32_t n = 0;
+	for (uint32_t i=0; i < hook_count; i++) {
+		if (hooks[i].function) hooks[n++] = hooks[i];
+	}
+	hook_count = n;
+	hooks_removed = false;
+	if (hook_count == 0) yield_active_check_flags &= ~YIELD_CHECK_HOOKS;
+}
 
 void yield(void) __attribute__ ((weak));
 void yield(void)
 {
-	const uint8_t check_flags = yield_active_check_flags;
+	uint32_t check_flags = yield_active_check_flags;
 	if (!check_flags) return;	// nothing to do
 
-	// TODO: do nothing if called from interrupt
+	// never call normal functions from any interrupt context
+	uint32_t ipsr;
+	__asm__ volatile("mrs %0, ipsr\n" : "=r" (ipsr)::);
+	if (ipsr != 0) return;
 
-	static uint8_t running=0;
-	if (running) return; // TODO: does this need to be atomic?
-	running = 1;
+	// From a fiber, switch to loop() and return when the fiber resumes.
+	// The fibers get their turn when loop() calls yield().
+	if ((check_flags & YIELD_CHECK_FIBERS) && Fiber::current()) {
+		Fiber::runFromYield();
+		return;
+	}
 
-	// USB Serial - Add hack to minimize impact...
-	if (check_flags & YIELD_CHECK_USB_SERIAL) {
-		if (Serial.available()) serialEvent();
+	check_flags &= (1 << YIELD_BUILTIN_COUNT) - 1;
+	while (check_flags) {
+		uint32_t bit = __builtin_ctz(check_flags);
+		check_flags &= check_flags - 1;
+		yield_run(&builtin[bit]);
+	}
+	if (yield_active_check_flags & YIELD_CHECK_HOOKS) {
+		// while hooks run, removed entries are only emptied, so no
+		// entry moves.  hook_count is re-read, a hook may add another.
+		hooks_running++;
+		for (uint32_t i=0; i < hook_count; i++) {
+			if (hooks[i].function) yield_run(&hooks[i]);
+		}
+		if (--hooks_running == 0 && hooks_removed) yield_hooks_pack();
 	}
+}
 
-#if defined(USB_DUAL_SERIAL) || defined(USB_TRIPLE_SERIAL)
-	if (check_flags & YIELD_CHECK_USB_SERIALUSB1) {
-		if (SerialUSB1.available()) serialEventUSB1();
+int yield_hook_add(yield_hook_function_t function)
+{
+	if (!function) return 0;
+	for (uint32_t i=0; i < hook_count; i++) {
+		if (hooks[i].function == function) return 1;
 	}
-#endif
-#ifdef USB_TRIPLE_SERIAL
-	if (check_flags & YIELD_CHECK_USB_SERIALUSB2) {
-		if (SerialUSB2.available()) serialEventUSB2();
+	if (hook_count >= YIELD_HOOKS_MAX) return 0;
+	hooks[hook_count].function = function;
+	hooks[hook_count].busy = 0;
+	hooks[hook_count].stats = {};
+	hook_count++;
+	yield_active_check_flags |= YIELD_CHECK_HOOKS;
+	return 1;
+}
+
+int yield_hook_remove(yield_hook_function_t function)
+{
+	if (!function) return 0;
+	for (uint32_t i=0; i < hook_count; i++) {
+		if (hooks[i].function == function) {
+			hooks[i].function = NULL;
+			hooks_removed = true;
+			// if called by a hook, yield() packs hooks[] when done
+			if (hooks_running == 0) yield_hooks_pack();
+			return 1;
+		}
 	}
-#endif
+	return 0;
+}
 
-	// Current workaround until integrate with EventResponder.
-	if (check_flags & YIELD_CHECK_HARDWARE_SERIAL) {
-		HardwareSerialIMXRT::processSerialEventsList();
+void yield_stats_enable(int enable)
+{
+	if (enable && !stats_enabled) {
+		for (uint32_t i=0; i < YIELD_BUILTIN_COUNT; i++) builtin[i].stats = {};
+		for (uint32_t i=0; i < hook_count; i++) hooks[i].stats = {};
 	}
+	stats_enabled = enable;
+}
 
-	running = 0;
-	if (check_flags & YIELD_CHECK_EVENT_RESPONDER) {
-		EventResponder::runFromYield();
+int yield_stats(unsigned int index, yield_hook_function_t *function, struct yield_hook_stats *stats)
+{
+	const struct yield_entry *entry;
+	if (index < YIELD_BUILTIN_COUNT) {
+		entry = &builtin[index];
+	} else if (index - YIELD_BUILTIN_COUNT < hook_count) {
+		entry = &hooks[index - YIELD_BUILTIN_COUNT];
+	} else {
+		return 0;
 	}
-};
+	if (function) *function = entry->function;
+	if (stats) *stats = entry->stats;
+	return 1;
+}
@@ -0,0 +1,221 @@
+// Runs audio graphs with the AUDIO_HOST_SIMULATION build of AudioStream.
+// Checks that audio passes through a graph without added latency, even
+// when its objects are created in reverse order or while audio runs, that
+// feedback loops are counted, that blocks left unread are reclaimed and
+// blocks sent to a full input are counted as dropped, and that cpu_cycles
+// and processorUsage() record each object's update time.
+//
+// AudioStream objects can't be destroyed, so each test creates its own
+// with new, disconnects them when it's done and leaves them running.
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "AudioStream.h"
+
+#define BLOCKS 1000
+
+static bool fail;
+static int test;       // objects record their updates only in their own test
+static char order[64]; // names of the objects updated, in order
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAILED: " __VA_ARGS__); printf("\n"); fail = true; } } while (0)
+
+static void updated(int object_test, char name)
+{
+	if (object_test != test) return;
+	size_t len = strlen(order);
+	if (len < sizeof(order) - 1) order[len] = name;
+}
+
+// The sample at each position of the simulated sample clock
+static int16_t ramp(uint64_t n)
+{
+	return (int16_t)(n * 7);
+}
+
+// Sends the ramp, or the same block twice to count drops
+class Source : public AudioStream {
+public:
+	Source(char name, int copies = 1) : AudioStream(0, NULL), name(name), copies(copies) {}
+	virtual void update(void) {
+		updated(object_test, name);
+		audio_block_t *block = allocate();
+		if (!block) return;
+		uint64_t n = simulation_samples();
+		for (int i=0; i < AUDIO_BLOCK_SAMPLES; i++) block->data[i] = ramp(n + i);
+		for (int i=0; i < copies; i++) transmit(block);
+		release(block);
+	}
+	int object_test = test;
+	char name;
+	int copies;
+};
+
+// Passes audio through, spending about busy_ns on each block
+class Effect : public AudioStream {
+public:
+	Effect(char name, unsigned int busy_ns = 0) : AudioStream(2, queue), name(name), busy_ns(busy_ns) {}
+	virtual void update(void) {
+		updated(object_test, name);
+		audio_block_t *a = receiveWritable(0);
+		audio_block_t *b = receiveReadOnly(1);
+		if (busy_ns) {
+			struct timespec ts, now;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			do {
+				clock_gettime(CLOCK_MONOTONIC, &now);
+			} while ((now.tv_sec - ts.tv_sec) * 1000000000 + (now.tv_nsec - ts.tv_nsec) < busy_ns);
+		}
+		if (a && b) {
+			for (int i=0; i < AUDIO_BLOCK_SAMPLES; i++) a->data[i] += b->data[i] / 8;
+		}
+		if (b) release(b);
+		if (a) {
+			transmit(a);
+			release(a);
+		}
+	}
+	audio_block_t *queue[2];
+	int object_test = test;
+	char name;
+	unsigned int busy_ns;
+};
+
+// Checks that each block holds the ramp for the current sample clock
+class Sink : public AudioStream {
+public:
+	Sink(char name, bool reads = true) : AudioStream(1, queue), name(name), reads(reads) {}
+	virtual void update(void) {
+		updated(object_test, name);
+		if (!reads) return;
+		audio_block_t *block = receiveReadOnly(0);
+		if (!block) {
+			missing++;
+			return;
+		}
+		uint64_t n = simulation_samples();
+		for (int i=0; i < AUDIO_BLOCK_SAMPLES; i++) {
+			if (block->data[i] != ramp(n + i)) {
+				wrong++;
+				break;
+			}
+		}
+		received++;
+		release(block);
+	}
+	audio_block_t *queue[1];
+	int object_test = test;
+	char name;
+	bool reads;
+	uint32_t received = 0, missing = 0, wrong = 0;
+};
+
+static void run(unsigned int blocks)
+{
+	memset(order, 0, sizeof(order));
+	AudioStream::simulate(blocks);
+}
+
+// Objects created last to first still update in data flow order, so a
+// chain adds no latency
+static void chain(void)
+{
+	test = 1;
+	Sink &out = *new Sink('o');
+	Effect &e2 = *new Effect('2'), &e1 = *new Effect('1');
+	Source &in = *new Source('i');
+	AudioConnection c1(in, e1), c2(e1, e2), c3(e2, out);
+
+	uint64_t start = AudioStream::simulation_samples();
+	run(1);
+	CHECK(strcmp(order, "i12o") == 0, "chain update order %s", order);
+	run(BLOCKS - 1);
+	CHECK(AudioStream::simulation_samples() - start == (uint64_t)BLOCKS * AUDIO_BLOCK_SAMPLES,
+		"sample clock advanced %llu", (unsigned long long)(AudioStream::simulation_samples() - start));
+	CHECK(out.received == BLOCKS && out.missing == 0 && out.wrong == 0,
+		"chain output: %u received, %u missing, %u wrong", out.received, out.missing, out.wrong);
+	CHECK(AudioFeedbackLoops() == 0, "chain has %d feedback loops", AudioFeedbackLoops());
+	CHECK(AudioMemoryUsage() == 0, "%d blocks still in use", AudioMemoryUsage());
+
+	// an object created while audio runs joins in data flow order
+	Effect &e3 = *new Effect('3');
+	c3.disconnect();
+	AudioConnection c4(e2, e3), c5(e3, out);
+	run(1);
+	CHECK(strcmp(order, "i123o") == 0, "order after adding an object %s", order);
+	CHECK(out.received == BLOCKS + 1 && out.wrong == 0, "output after adding an object");
+}
+
+// A feedback loop must be cut once, and nothing else may be delayed
+static void feedback(void)
+{
+	test = 2;
+	Sink &out = *new Sink('o');
+	Effect &fb = *new Effect('f'), &mix = *new Effect('m');
+	Source &in = *new Source('i');
+	AudioConnection c1(in, 0, mix, 0), c2(mix, fb), c3(fb, 0, mix, 1), c4(mix, out);
+
+	run(1);
+	// the output and the feedback path may update in either order
+	CHECK(strcmp(order, "imfo") == 0 || strcmp(order, "imof") == 0, "feedback update order %s", order);
+	CHECK(AudioFeedbackLoops() == 1, "feedback loops %d, should be 1", AudioFeedbackLoops());
+	c3.disconnect();
+	run(1);
+	CHECK(AudioFeedbackLoops() == 0, "feedback loops %d after disconnect", AudioFeedbackLoops());
+}
+
+// Blocks an object never reads are reclaimed after its update, and blocks
+// arriving at an input which is still full are dropped
+static void counters(void)
+{
+	test = 3;
+	Sink &lazy = *new Sink('l', false), &out = *new Sink('o');
+	Source &in = *new Source('i'), &twice = *new Source('t', 2);
+	AudioConnection c1(in, lazy), c2(twice, out);
+
+	run(BLOCKS);
+	CHECK(c1.blocksReclaimed() == BLOCKS && c1.blocksDropped() == 0,
+		"unread input: %u reclaimed, %u dropped", c1.blocksReclaimed(), c1.blocksDropped());
+	CHECK(c2.blocksDropped() == BLOCKS && c2.blocksReclaimed() == 0,
+		"double send: %u dropped, %u reclaimed", c2.blocksDropped(), c2.blocksReclaimed());
+	CHECK(out.received == BLOCKS && out.wrong == 0, "double send output");
+	CHECK(AudioMemoryUsage() == 0, "%d blocks still in use", AudioMemoryUsage());
+	c1.blockCountersReset();
+	CHECK(c1.blocksReclaimed() == 0, "counters not reset");
+}
+
+// Each object's update time is recorded, in ns / 64 on the host
+static void cpu_usage(void)
+{
+	test = 4;
+	Sink &out = *new Sink('o');
+	Effect &slow = *new Effect('s', 100000), &fast = *new Effect('f');
+	Source &in = *new Source('i');
+	AudioConnection c1(in, slow), c2(slow, fast), c3(fast, out);
+
+	AudioProcessorUsageMaxReset();
+	run(100);
+	// 100 us of the 1451 us per block
+	float usage = slow.processorUsage();
+	printf("cpu_cycles: slow %u (max %u), fast %u, total %u\n",
+		slow.cpu_cycles, slow.cpu_cycles_max, fast.cpu_cycles, AudioStream::cpu_cycles_total);
+	printf("processorUsage(): slow %.2f%%, fast %.2f%%, total %.2f%%\n",
+		usage, fast.processorUsage(), AudioProcessorUsage());
+	CHECK(slow.cpu_cycles >= 100000 / 64, "slow cpu_cycles %u, should be at least %u", slow.cpu_cycles, 100000 / 64);
+	CHECK(slow.cpu_cycles_max >= slow.cpu_cycles, "cpu_cycles_max below cpu_cycles");
+	CHECK(usage >= 6.8f && usage < 50.0f, "slow processorUsage() %.2f%%, should be about 6.9%%", usage);
+	CHECK(fast.cpu_cycles < slow.cpu_cycles, "fast object used more time than slow");
+	CHECK(AudioStream::cpu_cycles_total >= slow.cpu_cycles + fast.cpu_cycles, "total below the sum of objects");
+	CHECK(AudioProcessorUsageMax() >= AudioProcessorUsage(), "AudioProcessorUsageMax() below AudioProcessorUsage()");
+}
+
+int main()
+{
+	AudioMemory(16);
+	chain();
+	feedback();
+	counters();
+	cpu_usage();
+	printf("audio graph: %s, %d blocks max in use\n", fail ? "FAILED" : "ok", AudioMemoryUsageMax());
+	return fail ? 1 : 0;
+}
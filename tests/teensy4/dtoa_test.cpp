@@ -0,0 +1,124 @@
+// dtoa_fixed() and Print::print(double, digits): checks output against
+// snprintf("%.*f"), which glibc rounds correctly, then measures the time
+// per call.  Against a core without dtoa_fixed(), only print() is tested.
+#include "host/bench.h"
+
+extern "C" int dtoa_fixed(double val, unsigned int precision, char *buf) __attribute__((weak));
+
+#define COUNT 3000000
+
+static int failures = 0;
+static int print_mismatches = 0;
+
+// Random doubles below 2^64 with every exponent, plus values close to
+// rounding ties and small decimals, which are the hard cases.
+static double random_double(void)
+{
+	uint64_t r = bench_random();
+	double d;
+	switch (r & 3) {
+	case 0: // any bit pattern in range
+		do {
+			uint64_t bits = bench_random();
+			memcpy(&d, &bits, sizeof(d));
+		} while (!isfinite(d) || fabs(d) >= 18446744073709551616.0);
+		return d;
+	case 1: // exact ties like 2.5, 0.125
+		return (double)(int64_t)(bench_random() % 2000001 - 1000000) / (1 << (r >> 2) % 12);
+	case 2: // decimals which aren't exact in binary
+		return (double)(int64_t)(bench_random() % 20000001 - 10000000) / pow(10, (r >> 2) % 8);
+	default: // near the 64 bit limit
+		return ldexp((double)(bench_random() >> 11), (int)((r >> 2) % 12));
+	}
+}
+
+static void check(double d, unsigned int precision)
+{
+	char buf[48], ref[400];
+	snprintf(ref, sizeof(ref), "%.*f", precision, d);
+	int len = dtoa_fixed(d, precision, buf);
+	if (len <= 0 || (size_t)len != strlen(ref) || memcmp(buf, ref, len) != 0) {
+		if (++failures <= 10) {
+			printf("  mismatch: %.17g, %u digits: \"%.*s\" should be \"%s\"\n",
+				d, precision, len > 0 ? len : 0, buf, ref);
+		}
+	}
+}
+
+static void verify(void)
+{
+	static const double edge[] = {0.0, -0.0, 0.5, 1.5, 2.5, -0.5, 0.05, 0.15,
+		0.25, 1e-300, 4.9e-324, 9.5, 99.95, 0.045, 1.005, 18446744073709549568.0,
+		9007199254740993.0, 123456789.987654321};
+	unsigned int p;
+	for (const double &d : edge) {
+		for (p=0; p <= 17; p++) check(d, p);
+	}
+	for (int i=0; i < COUNT; i++) {
+		check(random_double(), (unsigned int)(bench_random() % 18));
+	}
+	char buf[48];
+	if (dtoa_fixed(NAN, 2, buf) != 0 || dtoa_fixed(INFINITY, 2, buf) != 0
+	  || dtoa_fixed(18446744073709551616.0, 2, buf) != 0) {
+		failures++;
+		printf("  nan, inf or 2^64 not refused\n");
+	}
+	printf("dtoa_fixed check, %d cases: %s\n", COUNT + 18 * 18, failures ? "FAILED" : "ok");
+}
+
+// print(double) should match printf too, except for its nan/inf/ovf words
+static void verify_print(void)
+{
+	CaptureSink out;
+	char ref[400];
+	for (int i=0; i < COUNT / 10; i++) {
+		double d = random_double();
+		unsigned int p = bench_random() % 10;
+		out.print(d, p);
+		snprintf(ref, sizeof(ref), "%.*f", p, d);
+		if (strcmp(out.str(), ref) != 0) print_mismatches++;
+		out.clear();
+	}
+	printf("print(double) differences from printf, %d cases: %d\n", COUNT / 10, print_mismatches);
+}
+
+static double values[100000];
+
+template <typename F>
+static void bench(const char *name, F f)
+{
+	const int n = sizeof(values) / sizeof(values[0]);
+	uint32_t sum = 0;
+	double begin = now_ns();
+	for (int rep=0; rep < 10; rep++) {
+		for (int i=0; i < n; i++) sum += f(values[i]);
+	}
+	double ns = (now_ns() - begin) / (10 * n);
+	printf("%-28s %7.1f ns/call  (%u)\n", name, ns, (unsigned)sum);
+}
+
+int main(void)
+{
+	if (dtoa_fixed) {
+		verify();
+	} else {
+		printf("this core has no dtoa_fixed()\n");
+	}
+	verify_print();
+	// the old printFloat() printed "ovf" above 4294967040
+	for (double &d : values) {
+		do {
+			d = random_double();
+		} while (fabs(d) > 4e9);
+	}
+	static NullSink out;
+	static char buf[400];
+	bench("print(double, 2)", [](double d) { return (uint32_t)out.print(d, 2); });
+	bench("print(double, 6)", [](double d) { return (uint32_t)out.print(d, 6); });
+	bench("snprintf %.6f", [](double d) { return (uint32_t)snprintf(buf, sizeof(buf), "%.6f", d); });
+	if (dtoa_fixed) {
+		bench("dtoa_fixed, 6", [](double d) { return (uint32_t)dtoa_fixed(d, 6, buf); });
+	}
+	bench("String(double, 6)", [](double d) { return (uint32_t)String(d, 6).length(); });
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,260 @@
+// Runs eeprom.c against a simulated NOR flash.  Checks that data survives
+// random writes, transactions and re-reading the flash at startup, and that
+// a commit erases each sector at most once.  Then counts the erase and
+// program operations of some write patterns, and the time the CPU would
+// spend in them with interrupts disabled.
+//
+// Built twice: eeprom_sim uses the default RAM shadow, eeprom_sim_noshadow
+// defines eeprom_ram_shadow() to turn it off, as a sketch could.
+#include "bench.h"
+#include <avr/eeprom.h>
+
+#define SECTORS 63
+#define SIZE (E2END+1)
+
+// Typical times from the W25Q64JV datasheet, used for the Teensy 4.1 flash:
+// 30 us for the first byte of a program, 2.5 us for each further byte and
+// 45 ms to erase a 4K sector.
+#define PROGRAM_FIRST_US 30.0
+#define PROGRAM_BYTE_US 2.5
+#define ERASE_US 45000.0
+
+extern "C" {
+alignas(4096) uint8_t eeprom_host_flash[SECTORS * 4096];
+
+static uint32_t erases, programs, sector_erases[SECTORS];
+static double stall_us, stall_max_us;
+static bool fail;
+
+static void stall(double us)
+{
+	stall_us += us;
+	if (us > stall_max_us) stall_max_us = us;
+}
+
+void eepromemu_flash_write(void *addr, const void *data, uint32_t len)
+{
+	uint8_t *p = (uint8_t *)addr;
+	const uint8_t *src = (const uint8_t *)data;
+	uint32_t offset = p - eeprom_host_flash;
+
+	if (p < eeprom_host_flash || offset + len > sizeof(eeprom_host_flash)
+	  || len == 0 || (offset & 255) + len > 256) {
+		printf("bad program, offset %u, len %u\n", offset, len);
+		fail = true;
+		return;
+	}
+	// programming can only clear bits
+	for (uint32_t i=0; i < len; i++) p[i] &= src[i];
+	programs++;
+	stall(PROGRAM_FIRST_US + PROGRAM_BYTE_US * (len - 1));
+}
+
+void eepromemu_flash_erase_sector(void *addr)
+{
+	uint32_t offset = (uint8_t *)addr - eeprom_host_flash;
+
+	if (offset >= sizeof(eeprom_host_flash) || (offset & 4095)) {
+		printf("bad erase, offset %u\n", offset);
+		fail = true;
+		return;
+	}
+	memset(eeprom_host_flash + offset, 0xFF, 4096);
+	erases++;
+	sector_erases[offset / 4096]++;
+	stall(ERASE_US);
+}
+
+#if defined(EEPROM_SIM_NO_SHADOW)
+uint8_t * eeprom_ram_shadow(void) { return NULL; }
+#endif
+}
+
+static uint8_t model[SIZE];
+
+static void reset_counts(void)
+{
+	erases = programs = 0;
+	memset(sector_erases, 0, sizeof(sector_erases));
+	stall_us = stall_max_us = 0;
+}
+
+// Compare everything eeprom.c returns with the model
+static void verify(const char *when)
+{
+	static uint8_t buf[SIZE];
+
+	eeprom_read_block(buf, (const void *)0, SIZE);
+	for (uint32_t a=0; a < SIZE; a++) {
+		uint8_t b = eeprom_read_byte((const uint8_t *)(uintptr_t)a);
+		if (buf[a] != model[a] || b != model[a]) {
+			printf("%s: address %u is %02X/%02X, should be %02X\n",
+				when, a, buf[a], b, model[a]);
+			fail = true;
+			return;
+		}
+	}
+}
+
+static void random_writes(uint32_t ops)
+{
+	static uint8_t buf[300];
+	bool transaction = false;
+	uint32_t before[SECTORS];
+
+	for (uint32_t n=0; n < ops; n++) {
+		uint32_t r = bench_random() % 100;
+		if (r < 5 && !transaction) {
+			eeprom_transaction_begin();
+			memcpy(before, sector_erases, sizeof(before));
+			transaction = true;
+		} else if (r < 10 && transaction) {
+			eeprom_transaction_commit();
+			transaction = false;
+#if !defined(EEPROM_SIM_NO_SHADOW)
+			for (int s=0; s < SECTORS; s++) {
+				if (sector_erases[s] - before[s] > 1) {
+					printf("commit erased sector %d %u times\n",
+						s, sector_erases[s] - before[s]);
+					fail = true;
+				}
+			}
+#endif
+			verify("after commit");
+		} else if (r < 12 && !transaction) {
+			// as at startup, rebuild everything from the flash
+			eeprom_initialize();
+			verify("after initialize");
+		} else {
+			uint32_t addr = bench_random() % SIZE;
+			uint32_t len = 1 + bench_random() % sizeof(buf);
+			for (uint32_t i=0; i < len; i++) {
+				// few distinct values, so some writes change nothing
+				buf[i] = bench_random() % 4;
+			}
+			if (r < 60) len = 1;
+			if (len == 1) {
+				eeprom_write_byte((uint8_t *)(uintptr_t)addr, buf[0]);
+			} else {
+				eeprom_write_block(buf, (void *)(uintptr_t)addr, len);
+			}
+			if (len > SIZE - addr) len = SIZE - addr;
+			memcpy(model + addr, buf, len);
+		}
+		if (fail) return;
+	}
+	if (transaction) eeprom_transaction_commit();
+	verify("at the end");
+}
+
+static void report(const char *name, uint32_t count)
+{
+	uint32_t wear = 0;
+	for (int s=0; s < SECTORS; s++) {
+		if (sector_erases[s] > wear) wear = sector_erases[s];
+	}
+	printf("%-38s %6u %6u %8.1f %8.2f %7.1f %5u\n", name, count, erases,
+		(double)programs / count, stall_us / 1000.0 / count,
+		stall_max_us / 1000.0, wear);
+}
+
+// Save a 256 byte settings struct at address 0, count times, with some
+// fields changing each time
+static void settings_writes(const char *name, int how, uint32_t count)
+{
+	uint8_t settings[256];
+
+	memset(settings, 0, sizeof(settings));
+	eeprom_write_block(settings, (void *)0, sizeof(settings));
+	reset_counts();
+	for (uint32_t n=0; n < count; n++) {
+		for (int i=0; i < 32; i++) settings[bench_random() % 256]++;
+		if (how == 0) {
+			for (int i=0; i < 256; i++) eeprom_write_byte((uint8_t *)(uintptr_t)i, settings[i]);
+		} else if (how == 1) {
+			eeprom_write_block(settings, (void *)0, sizeof(settings));
+		} else {
+			eeprom_transaction_begin();
+			for (int i=0; i < 256; i++) eeprom_write_byte((uint8_t *)(uintptr_t)i, settings[i]);
+			eeprom_transaction_commit();
+		}
+	}
+	report(name, count);
+	memcpy(model, settings, sizeof(settings));
+}
+
+// Log count single byte samples to a 64 byte ring, committing every 16
+static void ring_writes(const char *name, bool transaction, uint32_t count)
+{
+	reset_counts();
+	for (uint32_t n=0; n < count; n++) {
+		if (transaction && n % 16 == 0) eeprom_transaction_begin();
+		uint32_t addr = 1024 + n % 64;
+		uint8_t data = bench_random();
+		eeprom_write_byte((uint8_t *)(uintptr_t)addr, data);
+		model[addr] = data;
+		if (transaction && n % 16 == 15) eeprom_transaction_commit();
+	}
+	report(name, count);
+}
+
+// Increment a 32 bit counter 64 times per save, count saves
+static void counter_writes(const char *name, bool transaction, uint32_t count)
+{
+	uint32_t counter = 0;
+
+	reset_counts();
+	for (uint32_t n=0; n < count; n++) {
+		if (transaction) eeprom_transaction_begin();
+		for (int i=0; i < 64; i++) {
+			eeprom_write_dword((uint32_t *)2048, ++counter);
+		}
+		if (transaction) eeprom_transaction_commit();
+	}
+	report(name, count);
+	memcpy(model + 2048, &counter, 4);
+}
+
+int main()
+{
+	memset(eeprom_host_flash, 0xFF, sizeof(eeprom_host_flash));
+	memset(model, 0xFF, sizeof(model));
+
+	random_writes(200000);
+	if (fail) return 1;
+	eeprom_initialize();
+	printf("random writes ok, %u erases\n", erases);
+
+	// with the shadow off, transactions write through immediately
+	eeprom_transaction_begin();
+	uint32_t p = programs;
+	eeprom_write_byte((uint8_t *)0, model[0] ^ 1);
+	model[0] ^= 1;
+	bool immediate = programs != p;
+	eeprom_transaction_commit();
+#if defined(EEPROM_SIM_NO_SHADOW)
+	if (!immediate) {
+		printf("write in a transaction without the shadow was deferred\n");
+		return 1;
+	}
+#else
+	if (immediate) {
+		printf("write in a transaction was not deferred\n");
+		return 1;
+	}
+#endif
+
+	printf("\n%-38s %6s %6s %8s %8s %7s %5s\n", "", "writes", "erases",
+		"programs", "stall ms", "max ms", "wear");
+	settings_writes("256 byte struct, eeprom_write_byte", 0, 500);
+	settings_writes("256 byte struct, eeprom_write_block", 1, 500);
+	settings_writes("256 byte struct, transaction", 2, 500);
+	ring_writes("ring byte, eeprom_write_byte", false, 20000);
+	ring_writes("ring byte, transaction of 16", true, 20000);
+	counter_writes("64 counter updates, eeprom_write_dword", false, 500);
+	counter_writes("64 counter updates, transaction", true, 500);
+
+	eeprom_initialize();
+	verify("after the benchmarks");
+	return fail ? 1 : 0;
+}
@@ -0,0 +1,80 @@
+// Print::format() compared with snprintf() followed by one write(), which
+// is what Print::printf() amounts to on Teensy.  Checks that both give the
+// same text, then measures the time per call.  For code size and cycles
+// on Teensy, see sketches/PrintFormatBench.
+#include "host/bench.h"
+
+#define COUNT 1000000
+
+static const char *names[] = {"", "a", "sensor", "pressure", "temperature"};
+
+struct Record {
+	int32_t id;
+	double temp;
+	uint32_t raw;
+	const char *name;
+	long long total;
+};
+
+static Record records[1000];
+
+static size_t with_format(Print &out, const Record &r)
+{
+	return out.format("id={} temp={:.2} raw={:04X} name={:<8}| total={}\n"_fmt,
+		r.id, r.temp, r.raw, r.name, r.total);
+}
+
+static size_t with_snprintf(Print &out, const Record &r)
+{
+	char buf[128];
+	int len = snprintf(buf, sizeof(buf), "id=%d temp=%.2f raw=%04X name=%-8s| total=%lld\n",
+		r.id, r.temp, r.raw, r.name, r.total);
+	return out.write((const uint8_t *)buf, len);
+}
+
+template <typename F>
+static void bench(const char *name, F f)
+{
+	NullSink out;
+	const int n = sizeof(records) / sizeof(records[0]);
+	double begin = now_ns();
+	for (int i=0; i < COUNT; i++) f(out, records[i % n]);
+	double ns = (now_ns() - begin) / COUNT;
+	printf("%-24s %7.1f ns/call  (%u)\n", name, ns, (unsigned)out.sum);
+}
+
+int main(void)
+{
+	int failures = 0;
+	for (Record &r : records) {
+		uint64_t x = bench_random();
+		r.id = (int32_t)x >> (x % 32);
+		r.temp = (double)(int32_t)(bench_random() % 200000 - 100000) / 1000.0;
+		r.raw = (uint32_t)bench_random() >> (x % 32);
+		r.name = names[x % 5];
+		r.total = (long long)bench_random() >> (x % 64);
+	}
+	// the extremes, where negating in signed arithmetic would overflow
+	records[0].id = INT32_MIN;
+	records[0].total = INT64_MIN;
+	records[1].id = INT32_MAX;
+	records[1].total = INT64_MAX;
+	records[2].id = -1;
+	records[2].total = -1;
+	records[3].id = 0;
+	records[3].total = 0;
+	CaptureSink a, b;
+	for (const Record &r : records) {
+		with_format(a, r);
+		with_snprintf(b, r);
+		if (strcmp(a.str(), b.str()) != 0) {
+			if (++failures <= 10) printf("  mismatch: %s  should be: %s", a.str(), b.str());
+		}
+		a.clear();
+		b.clear();
+	}
+	printf("output check: %s\n", failures ? "FAILED" : "ok");
+	bench("format()", with_format);
+	bench("snprintf() + write()", with_snprintf);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,25 @@
+// The parts of Arduino.h used by Print, String and Stream, for host builds
+#ifndef Arduino_h
+#define Arduino_h
+
+#include "avr_functions.h"
+#include "Print.h"
+#include "Stream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+unsigned long millis(void);
+void yield(void);
+#ifdef __cplusplus
+}
+#endif
+
+class HostSerial : public Print {
+public:
+	virtual size_t write(uint8_t b) { return fwrite(&b, 1, 1, stdout); }
+	virtual size_t write(const uint8_t *buffer, size_t size) { return fwrite(buffer, 1, size, stdout); }
+};
+extern HostSerial Serial;
+
+#endif
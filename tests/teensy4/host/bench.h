@@ -0,0 +1,59 @@
+// Helpers shared by the host tests and benchmarks
+#ifndef bench_h_
+#define bench_h_
+
+#include <Arduino.h>
+
+static inline double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Keeps the last output, for comparing against a reference
+class CaptureSink : public Print {
+public:
+	virtual size_t write(uint8_t b) {
+		if (len < sizeof(buf) - 1) buf[len++] = b;
+		buf[len] = 0;
+		return 1;
+	}
+	virtual size_t write(const uint8_t *buffer, size_t size) {
+		for (size_t i=0; i < size; i++) write(buffer[i]);
+		return size;
+	}
+	const char * str() { return buf; }
+	void clear() { len = 0; buf[0] = 0; }
+	char buf[512];
+	size_t len = 0;
+};
+
+// Discards output, but sums it so nothing is optimized away
+class NullSink : public Print {
+public:
+	virtual size_t write(uint8_t b) {
+		sum += b;
+		count++;
+		return 1;
+	}
+	virtual size_t write(const uint8_t *buffer, size_t size) {
+		for (size_t i=0; i < size; i++) sum += buffer[i];
+		count += size;
+		return size;
+	}
+	uint32_t sum = 0;
+	uint64_t count = 0;
+};
+
+// A simple repeatable random number generator (xorshift64)
+static inline uint64_t bench_random(void)
+{
+	static uint64_t x = 88172645463325252ull;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return x;
+}
+
+#endif
@@ -0,0 +1,20 @@
+#include <Arduino.h>
+
+HostSerial Serial;
+
+unsigned long millis(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void yield(void)
+{
+}
+
+// newlib's float version of fcvt(), used by dtostrf()
+extern "C" char * fcvtf(float val, int ndigit, int *decpt, int *sign)
+{
+	return fcvt(val, ndigit, decpt, sign);
+}
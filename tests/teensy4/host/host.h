@@ -0,0 +1,35 @@
+// Included ahead of everything when building core files for a 64 bit host.
+// On Teensy, long is 32 bits, so Print's long and int64_t overloads are
+// different functions.  Here they would be the same type, so int64_t and
+// uint64_t are made long long, after the system headers have their own
+// typedefs.
+#ifndef host_h_
+#define host_h_
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+
+#define int64_t long long
+#define uint64_t unsigned long long
+
+// newlib has these, glibc doesn't
+#ifdef __cplusplus
+extern "C" {
+#endif
+char * ultoa(unsigned long val, char *buf, int radix);
+char * ltoa(long val, char *buf, int radix);
+static inline char * utoa(unsigned int val, char *buf, int radix) { return ultoa(val, buf, radix); }
+static inline char * itoa(int val, char *buf, int radix) { return ltoa(val, buf, radix); }
+#ifdef __cplusplus
+}
+#endif
+
+#endif
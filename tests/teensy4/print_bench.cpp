@@ -0,0 +1,83 @@
+// Print::print() integer formatting: checks output against snprintf, then
+// measures the time per call.  Build with CORE= another teensy4 directory
+// to compare against a different version of Print.cpp.
+#include "host/bench.h"
+
+#define COUNT 2000000
+
+static uint32_t u32[COUNT];
+static uint64_t u64[COUNT];
+
+// numbers of every length, not only huge ones
+static void fill(void)
+{
+	for (int i=0; i < COUNT; i++) {
+		uint64_t r = bench_random();
+		u64[i] = r >> (r % 64);
+		u32[i] = (uint32_t)r >> (r % 32);
+	}
+}
+
+static int failures = 0;
+
+static void check(CaptureSink &out, const char *expect)
+{
+	if (strcmp(out.str(), expect) != 0) {
+		if (++failures <= 10) printf("  mismatch: \"%s\" should be \"%s\"\n", out.str(), expect);
+	}
+	out.clear();
+}
+
+static void verify(void)
+{
+	CaptureSink out;
+	char ref[80];
+	for (int i=0; i < COUNT; i += 7) {
+		out.print(u32[i]);
+		snprintf(ref, sizeof(ref), "%u", u32[i]);
+		check(out, ref);
+		out.print((int32_t)u32[i]);
+		snprintf(ref, sizeof(ref), "%d", (int32_t)u32[i]);
+		check(out, ref);
+		out.print(u32[i], HEX);
+		snprintf(ref, sizeof(ref), "%X", u32[i]);
+		check(out, ref);
+		out.print(u32[i], OCT);
+		snprintf(ref, sizeof(ref), "%o", u32[i]);
+		check(out, ref);
+		out.print(u64[i]);
+		snprintf(ref, sizeof(ref), "%llu", u64[i]);
+		check(out, ref);
+		out.print((int64_t)u64[i]);
+		snprintf(ref, sizeof(ref), "%lld", (int64_t)u64[i]);
+		check(out, ref);
+		out.print(u64[i], HEX);
+		snprintf(ref, sizeof(ref), "%llX", u64[i]);
+		check(out, ref);
+	}
+	printf("output check: %s\n", failures ? "FAILED" : "ok");
+}
+
+template <typename F>
+static void bench(const char *name, F f)
+{
+	NullSink out;
+	double begin = now_ns();
+	for (int i=0; i < COUNT; i++) f(out, i);
+	double ns = (now_ns() - begin) / COUNT;
+	printf("%-24s %7.1f ns/call  (%u)\n", name, ns, (unsigned)out.sum);
+}
+
+int main(void)
+{
+	volatile int base10 = 10;
+	fill();
+	verify();
+	bench("uint32 dec", [](NullSink &out, int i) { out.print(u32[i]); });
+	bench("int32 dec", [](NullSink &out, int i) { out.print((int32_t)u32[i]); });
+	bench("uint32 hex", [](NullSink &out, int i) { out.print(u32[i], HEX); });
+	bench("uint32 dec, base var", [&](NullSink &out, int i) { out.print(u32[i], (int)base10); });
+	bench("uint64 dec", [](NullSink &out, int i) { out.print(u64[i]); });
+	bench("uint64 hex", [](NullSink &out, int i) { out.print(u64[i], HEX); });
+	return failures ? 1 : 0;
+}
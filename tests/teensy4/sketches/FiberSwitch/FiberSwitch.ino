@@ -0,0 +1,95 @@
+// Measure the cost of switching between Fibers on Teensy 4, and check
+// that the registers a function keeps across calls survive a switch.
+//
+// Each yield() from loop() switches to the fiber, which calls yield()
+// to switch back, so one round trip is 2 switches plus the work yield()
+// always does.  That work is measured first, with the fiber stopped,
+// and subtracted.  Half the rest is one switch: fiber_switch() plus the
+// scheduling in yield() which picks the next fiber.
+
+#include <Fiber.h>
+
+#define ROUNDS 10000
+
+Fiber spinner;
+uint32_t spinnerStack[512];
+volatile bool spinnerRun = true;
+
+void spin(void *arg) {
+	while (spinnerRun) yield();
+}
+
+// Keeps many integer and float values live across yield(), so the
+// compiler holds them in r4-r11 and d8-d15, then repeats the same math
+// without yield() and compares.
+Fiber checker;
+uint32_t checkerStack[512];
+volatile int checkResult = 0; // 0 = running, 1 = ok, -1 = failed
+
+static void mix(uint32_t *a, double *x, int n) {
+	for (int i=0; i < n; i++) {
+		a[0] = a[0] * 3 + 1;	a[1] ^= a[0] << 3;
+		a[2] += a[1] >> 2;	a[3] = a[3] * 5 + a[2];
+		a[4] -= a[3];		a[5] = (a[5] << 1) | (a[4] >> 31);
+		a[6] += a[5] * 7;	a[7] ^= a[6] + a[0];
+		x[0] = x[0] * 1.0001 + 0.5;	x[1] = x[1] * 0.9999 - x[0] * 1e-6;
+		x[2] += x[1] * 0.25;		x[3] = x[3] * 0.5 + x[2];
+		x[4] -= x[3] * 1e-3;		x[5] = x[5] * 1.5 - x[4];
+		x[6] += x[5] * 1e-4;		x[7] = x[7] * 0.75 + x[6];
+		if (n == 1) yield();
+	}
+}
+
+void check(void *arg) {
+	uint32_t a[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+	double x[8] = {0.5, 1.5, 2.5, 3.5, 4.5, 5.5, 6.5, 7.5};
+	uint32_t b[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+	double y[8] = {0.5, 1.5, 2.5, 3.5, 4.5, 5.5, 6.5, 7.5};
+	for (int i=0; i < 1000; i++) mix(a, x, 1); // yields each time
+	mix(b, y, 1000);
+	checkResult = (memcmp(a, b, sizeof(a)) == 0 && memcmp(x, y, sizeof(x)) == 0) ? 1 : -1;
+}
+
+uint32_t cyclesPerYield() {
+	uint32_t begin = ARM_DWT_CYCCNT;
+	for (int i=0; i < ROUNDS; i++) yield();
+	return (ARM_DWT_CYCCNT - begin) / ROUNDS;
+}
+
+void setup() {
+	Serial.begin(9600);
+	while (!Serial && millis() < 4000) ;
+
+	checker.begin(check, nullptr, checkerStack);
+	// loop() also keeps values live while the checker runs
+	uint32_t a = 12345, b = 67890;
+	double x = 1.25, y = -3.5;
+	while (checkResult == 0) {
+		yield();
+		a = a * 3 + b;
+		x = x * 1.5 + y;
+	}
+	Serial.print("registers across switches: ");
+	Serial.println(checkResult > 0 ? "ok" : "FAILED");
+	Serial.println(a + x); // keep a and x in use
+	Serial.print("checker stack unused: ");
+	Serial.println(checker.stackUnused());
+}
+
+void loop() {
+	spinnerRun = false;
+	while (spinner.running()) yield();
+	uint32_t base = cyclesPerYield();
+	spinnerRun = true;
+	spinner.begin(spin, nullptr, spinnerStack);
+	yield(); // first switch into the fiber
+	uint32_t total = cyclesPerYield();
+	Serial.print("yield() without fibers: ");
+	Serial.print(base);
+	Serial.print(" cycles, with 1 fiber: ");
+	Serial.print(total);
+	Serial.print(" cycles, per switch: ");
+	Serial.print((total - base) / 2);
+	Serial.println(" cycles");
+	delay(2000);
+}
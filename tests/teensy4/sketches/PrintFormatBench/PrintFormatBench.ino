@@ -0,0 +1,77 @@
+// Compare Print::format() with Print::printf() on Teensy 4.
+//
+// Cycles: upload as is.  Both are run on the same values into a Print
+// which discards the output, and the average CPU cycles per call are
+// printed to the Serial Monitor.
+//
+// Code size: set BENCH to 1 (format only) or 2 (printf only), compile,
+// and compare the "FLASH: code" sizes reported for each with BENCH 3,
+// which uses neither.
+
+#define BENCH 0  // 0 = both, 1 = format only, 2 = printf only, 3 = neither
+
+class NullPrint : public Print {
+public:
+	virtual size_t write(uint8_t b) { sum += b; return 1; }
+	virtual size_t write(const uint8_t *buffer, size_t size) {
+		for (size_t i=0; i < size; i++) sum += buffer[i];
+		return size;
+	}
+	uint32_t sum = 0;
+};
+
+NullPrint out;
+
+struct Record {
+	int32_t id;
+	float temp;
+	uint32_t raw;
+	const char *name;
+};
+
+const char *names[] = {"", "a", "sensor", "pressure", "temperature"};
+Record records[64];
+
+void setup() {
+	Serial.begin(9600);
+	while (!Serial && millis() < 4000) ;
+	for (Record &r : records) {
+		r.id = random(-100000, 100000);
+		r.temp = random(-100000, 100000) / 1000.0f;
+		r.raw = random(0, 65536);
+		r.name = names[random(0, 5)];
+	}
+}
+
+void loop() {
+	uint32_t cycles;
+	const int n = sizeof(records) / sizeof(records[0]);
+	(void)cycles;
+	(void)n;
+#if BENCH == 0 || BENCH == 1
+	cycles = ARM_DWT_CYCCNT;
+	for (int i=0; i < n; i++) {
+		const Record &r = records[i];
+		out.format("id={} temp={:.2} raw={:04X} name={:<8}|\n"_fmt,
+			r.id, r.temp, r.raw, r.name);
+	}
+	cycles = ARM_DWT_CYCCNT - cycles;
+	Serial.print("format(): ");
+	Serial.print(cycles / n);
+	Serial.println(" cycles per call");
+#endif
+#if BENCH == 0 || BENCH == 2
+	cycles = ARM_DWT_CYCCNT;
+	for (int i=0; i < n; i++) {
+		const Record &r = records[i];
+		out.printf("id=%ld temp=%.2f raw=%04lX name=%-8s|\n",
+			r.id, r.temp, r.raw, r.name);
+	}
+	cycles = ARM_DWT_CYCCNT - cycles;
+	Serial.print("printf(): ");
+	Serial.print(cycles / n);
+	Serial.println(" cycles per call");
+#endif
+	Serial.println(out.sum);
+	delay(2000);
+}
@@ -0,0 +1,125 @@
+// Compare the USB serial transmit methods on Teensy 4: Serial.write(),
+// writeAcquire()/writeCommit() filling the USB buffer in place, and
+// writeSubmit() from the sketch's own buffers.
+//
+// Each sends TOTAL bytes of text, produced by the same produce() function,
+// as fast as the PC reads them.  MB/s is the total over the elapsed time.
+// Cycles per KB counts only the time spent producing and sending, not
+// waiting for buffer space, minus the cost of produce() alone.  That is
+// the CPU time each method leaves for the rest of the program.
+//
+// Compile with Tools > USB Type > Serial, close the Serial Monitor (it
+// can't keep up), and read the port with a fast program which shows only
+// the results, for example on Linux or macOS:
+//   cat /dev/ttyACM0 | grep -a '^#'
+
+#define TOTAL (16 * 1024 * 1024)
+#define CHUNK 2048
+#define SUBMIT_SIZE 8192
+
+// The data: lines of text with a counter, which costs about as much to
+// produce as typical telemetry formatting
+uint32_t line;
+
+void produce(uint8_t *p, uint32_t size) {
+	while (size > 0) {
+		uint32_t n = line++;
+		char text[16];
+		int len = 0;
+		text[len++] = '\n';
+		for (int i=0; i < 8; i++) {
+			text[len++] = "0123456789ABCDEF"[n & 15];
+			n >>= 4;
+		}
+		while (len < 16) text[len++] = ' ';
+		uint32_t count = (size < 16) ? size : 16;
+		for (uint32_t i=0; i < count; i++) *p++ = text[15 - i];
+		size -= count;
+	}
+}
+
+uint8_t buffer[CHUNK];
+DMAMEM uint8_t submitBuffer[2][SUBMIT_SIZE] __attribute__((aligned(32)));
+
+uint32_t busyCycles;
+
+// Wait for the PC to take data, without counting the time as busy
+void waitForSpace() {
+	while (Serial.availableForWrite() < CHUNK) ;
+}
+
+void sendWrite() {
+	for (uint32_t sent=0; sent < TOTAL; sent += CHUNK) {
+		waitForSpace();
+		uint32_t begin = ARM_DWT_CYCCNT;
+		produce(buffer, CHUNK);
+		Serial.write(buffer, CHUNK);
+		busyCycles += ARM_DWT_CYCCNT - begin;
+	}
+}
+
+void sendAcquire() {
+	for (uint32_t sent=0; sent < TOTAL; ) {
+		waitForSpace();
+		uint32_t begin = ARM_DWT_CYCCNT;
+		uint32_t size;
+		uint8_t *p = (uint8_t *)Serial.writeAcquire(&size);
+		if (!p) return;
+		if (size > TOTAL - sent) size = TOTAL - sent;
+		produce(p, size);
+		Serial.writeCommit(size);
+		sent += size;
+		busyCycles += ARM_DWT_CYCCNT - begin;
+	}
+}
+
+void sendSubmit() {
+	for (uint32_t sent=0, n=0; sent < TOTAL; sent += SUBMIT_SIZE, n++) {
+		uint8_t *p = submitBuffer[n & 1];
+		while (Serial.writePending(p)) ;
+		waitForSpace();
+		uint32_t begin = ARM_DWT_CYCCNT;
+		produce(p, SUBMIT_SIZE);
+		Serial.writeSubmit(p, SUBMIT_SIZE);
+		busyCycles += ARM_DWT_CYCCNT - begin;
+	}
+}
+
+// Cycles per KB of produce() alone
+uint32_t produceCycles() {
+	uint32_t begin = ARM_DWT_CYCCNT;
+	for (int i=0; i < 64; i++) produce(buffer, CHUNK);
+	return (ARM_DWT_CYCCNT - begin) / (64 * CHUNK / 1024);
+}
+
+void run(const char *name, void (*send)()) {
+	busyCycles = 0;
+	uint32_t begin = micros();
+	send();
+	Serial.send_now();
+	uint32_t elapsed = micros() - begin;
+	uint32_t produceKB = produceCycles();
+	Serial.println();
+	Serial.print("# ");
+	Serial.print(name);
+	Serial.print(": ");
+	Serial.print((float)TOTAL / elapsed, 2);
+	Serial.print(" MB/s, ");
+	Serial.print((int)(busyCycles / (TOTAL / 1024) - produceKB));
+	Serial.print(" cycles per KB to send (");
+	Serial.print(produceKB);
+	Serial.println(" more to produce)");
+}
+
+void setup() {
+	while (!Serial) ;
+	delay(500);
+}
+
+void loop() {
+	run("write()", sendWrite);
+	run("writeAcquire()/writeCommit()", sendAcquire);
+	run("writeSubmit()", sendSubmit);
+	Serial.println("#");
+	delay(2000);
+}
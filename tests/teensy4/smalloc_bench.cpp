@@ -0,0 +1,234 @@
+// Replays an allocation trace through the first-fit smalloc from before
+// sm_bins.c (old_ symbols, see the Makefile) and through the current
+// binned smalloc, and reports the time per call.  The trace is read from
+// a file given as argument, one call per line:
+//   m <id> <size>    malloc
+//   r <id> <size>    realloc
+//   f <id>           free
+// Without a file, traces are generated for an 8 MB pool, as extmem_malloc()
+// has on a Teensy 4.1 with one PSRAM chip.  The pool isn't zeroed (Teensy
+// zeroes PSRAM allocations, which adds the same time to both).
+#include "host/bench.h"
+#include <smalloc.h>
+#include <algorithm>
+#include <vector>
+
+#define POOL_SIZE (8 * 1024 * 1024)
+
+extern "C" {
+// the first-fit version's struct smalloc_pool had only these fields
+struct old_smalloc_pool {
+	void *pool;
+	size_t pool_size;
+	int do_zero;
+	smalloc_oom_handler oomfn;
+};
+int old_sm_set_pool(struct old_smalloc_pool *, void *, size_t, int, smalloc_oom_handler);
+void *old_sm_malloc_pool(struct old_smalloc_pool *, size_t);
+void *old_sm_realloc_pool(struct old_smalloc_pool *, void *, size_t);
+void old_sm_free_pool(struct old_smalloc_pool *, void *);
+}
+
+struct Op {
+	char type;
+	uint32_t id;
+	uint32_t size;
+};
+
+struct OldAllocator {
+	old_smalloc_pool pool;
+	OldAllocator(void *mem) { memset(&pool, 0, sizeof(pool)); old_sm_set_pool(&pool, mem, POOL_SIZE, 0, NULL); }
+	void * malloc(size_t n) { return old_sm_malloc_pool(&pool, n); }
+	void * realloc(void *p, size_t n) { return old_sm_realloc_pool(&pool, p, n); }
+	void free(void *p) { old_sm_free_pool(&pool, p); }
+};
+
+struct NewAllocator {
+	smalloc_pool pool;
+	NewAllocator(void *mem) { memset(&pool, 0, sizeof(pool)); sm_set_pool(&pool, mem, POOL_SIZE, 0, NULL); }
+	void * malloc(size_t n) { return sm_malloc_pool(&pool, n); }
+	void * realloc(void *p, size_t n) { return sm_realloc_pool(&pool, p, n); }
+	void free(void *p) { sm_free_pool(&pool, p); }
+};
+
+// Random size, mostly small with some up to 64K, like a mix of strings,
+// objects and buffers
+static uint32_t random_size(void)
+{
+	uint32_t bits = (bench_random() % 100 < 80) ? 4 + bench_random() % 7 : 10 + bench_random() % 7;
+	return (1u << bits) + bench_random() % (1u << bits);
+}
+
+// Fill the pool to about fill bytes, then keep it there with random frees,
+// mallocs and reallocs, so the free space gets fragmented
+static std::vector<Op> generate(uint32_t fill, uint32_t count)
+{
+	std::vector<Op> ops;
+	std::vector<uint32_t> live, sizes;
+	uint64_t bytes = 0;
+	uint32_t next_id = 0;
+
+	while (ops.size() < count) {
+		uint32_t r = bench_random() % 100;
+		if (!live.empty() && r < 10) {
+			uint32_t i = bench_random() % live.size();
+			uint32_t size = random_size();
+			bytes += size - sizes[i];
+			sizes[i] = size;
+			ops.push_back({'r', live[i], size});
+		} else if (!live.empty() && (bytes > fill || r < 40)) {
+			uint32_t i = bench_random() % live.size();
+			ops.push_back({'f', live[i], 0});
+			bytes -= sizes[i];
+			live[i] = live.back();
+			live.pop_back();
+			sizes[i] = sizes.back();
+			sizes.pop_back();
+		} else {
+			uint32_t size = random_size();
+			ops.push_back({'m', next_id, size});
+			live.push_back(next_id++);
+			sizes.push_back(size);
+			bytes += size;
+		}
+	}
+	return ops;
+}
+
+static std::vector<Op> load(const char *filename)
+{
+	std::vector<Op> ops;
+	FILE *f = fopen(filename, "r");
+	if (!f) {
+		perror(filename);
+		exit(1);
+	}
+	char type;
+	unsigned id, size;
+	while (fscanf(f, " %c %u", &type, &id) == 2) {
+		size = 0;
+		if (type != 'f' && fscanf(f, "%u", &size) != 1) break;
+		ops.push_back({type, id, size});
+	}
+	fclose(f);
+	return ops;
+}
+
+// Each block starts and ends with its id, checked when it's freed
+static void mark(void *p, uint32_t id, uint32_t size)
+{
+	if (size < 8) return;
+	memcpy(p, &id, 4);
+	memcpy((char *)p + size - 4, &id, 4);
+}
+
+static bool check(void *p, uint32_t id, uint32_t size)
+{
+	uint32_t a, b;
+	if (size < 8) return true;
+	memcpy(&a, p, 4);
+	memcpy(&b, (char *)p + size - 4, 4);
+	return a == id && b == id;
+}
+
+struct Times {
+	std::vector<float> ns[3];
+	uint32_t failed;
+	bool corrupt;
+};
+
+template <typename A>
+static void replay(const std::vector<Op> &ops, void *mem, Times &t)
+{
+	A a(mem);
+	std::vector<void *> ptr;
+	std::vector<uint32_t> size;
+
+	t.failed = 0;
+	t.corrupt = false;
+	for (auto &v : t.ns) v.clear();
+	for (const Op &op : ops) {
+		if (op.id >= ptr.size()) {
+			ptr.resize(op.id + 1, nullptr);
+			size.resize(op.id + 1, 0);
+		}
+		void *p = ptr[op.id];
+		double begin = now_ns();
+		if (op.type == 'm') {
+			if (p) continue;
+			p = a.malloc(op.size);
+			t.ns[0].push_back(now_ns() - begin);
+			if (!p) t.failed++;
+		} else if (op.type == 'r') {
+			if (!p) continue;
+			if (!check(p, op.id, size[op.id])) t.corrupt = true;
+			begin = now_ns();
+			void *n = a.realloc(p, op.size);
+			t.ns[1].push_back(now_ns() - begin);
+			if (n) {
+				p = n;
+			} else {
+				t.failed++;
+				continue;
+			}
+		} else {
+			if (!p) continue;
+			if (!check(p, op.id, size[op.id])) t.corrupt = true;
+			begin = now_ns();
+			a.free(p);
+			t.ns[2].push_back(now_ns() - begin);
+			p = nullptr;
+		}
+		ptr[op.id] = p;
+		size[op.id] = op.size;
+		if (p) mark(p, op.id, op.size);
+	}
+}
+
+static float percentile(std::vector<float> &v, double p)
+{
+	if (v.empty()) return 0;
+	size_t i = (size_t)(p * (v.size() - 1));
+	std::nth_element(v.begin(), v.begin() + i, v.end());
+	return v[i];
+}
+
+static bool report(const char *trace, const std::vector<Op> &ops, void *mem)
+{
+	static const char *names[3] = {"malloc", "realloc", "free"};
+	Times old_t, new_t;
+
+	replay<OldAllocator>(ops, mem, old_t);
+	replay<NewAllocator>(ops, mem, new_t);
+	printf("%s, %zu calls, failed old %u new %u\n", trace, ops.size(), old_t.failed, new_t.failed);
+	for (int i=0; i < 3; i++) {
+		printf("  %-8s p50 %9.0f ns %7.0f ns   p99 %9.0f ns %7.0f ns   max %9.0f ns %7.0f ns\n", names[i],
+			percentile(old_t.ns[i], 0.5), percentile(new_t.ns[i], 0.5),
+			percentile(old_t.ns[i], 0.99), percentile(new_t.ns[i], 0.99),
+			percentile(old_t.ns[i], 1.0), percentile(new_t.ns[i], 1.0));
+	}
+	if (old_t.corrupt || new_t.corrupt) {
+		printf("  block contents were overwritten (old %d, new %d)\n", old_t.corrupt, new_t.corrupt);
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	void *mem = aligned_alloc(4096, POOL_SIZE);
+	bool ok = true;
+
+	memset(mem, 0, POOL_SIZE);  // no page faults while timing
+
+	printf("times are old first-fit, then new binned\n");
+	if (argc > 1) {
+		for (int i=1; i < argc; i++) ok &= report(argv[i], load(argv[i]), mem);
+	} else {
+		ok &= report("pool 25% full", generate(POOL_SIZE / 4, 100000), mem);
+		ok &= report("pool 75% full", generate(POOL_SIZE * 3 / 4, 100000), mem);
+		ok &= report("pool 95% full", generate(POOL_SIZE * 95 / 100, 100000), mem);
+	}
+	free(mem);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,109 @@
+// String: counts heap calls and measures time for concat heavy code, and
+// heap fragmentation left by many Strings growing at once.  Build with
+// CORE= another teensy4 directory to compare with a different WString.
+#include "host/bench.h"
+#include <malloc.h>
+
+// String's calls to malloc, realloc and free are counted by linking
+// with --wrap, which sends them here
+static uint32_t mallocs, reallocs, frees;
+
+extern "C" {
+void * __real_malloc(size_t size);
+void * __real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void * __wrap_malloc(size_t size)
+{
+	mallocs++;
+	return __real_malloc(size);
+}
+
+void * __wrap_realloc(void *ptr, size_t size)
+{
+	reallocs++;
+	return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr)
+{
+	if (ptr) frees++;
+	__real_free(ptr);
+}
+}
+
+#define REPEAT 20000
+
+template <typename F>
+static void bench(const char *name, F f)
+{
+	mallocs = reallocs = frees = 0;
+	uint32_t sum = 0;
+	double begin = now_ns();
+	for (int i=0; i < REPEAT; i++) sum += f(i);
+	double ns = (now_ns() - begin) / REPEAT;
+	printf("%-30s %8.1f ns %8.2f malloc %8.2f realloc %8.2f free  (%u)\n", name, ns,
+		(double)mallocs / REPEAT, (double)reallocs / REPEAT, (double)frees / REPEAT,
+		(unsigned)sum);
+}
+
+// Many Strings growing at the same time, in turns, the way a program
+// collecting several lines of input would.  Reports the heap they use and
+// the free gaps left between blocks, not counting free space at the top
+// of the heap, as a percentage of the heap below the top.
+static void fragmentation(int count, int length)
+{
+	String *s = new String[count];
+	struct mallinfo2 before = mallinfo2();
+	for (int n=0; n < length; n++) {
+		for (int i=0; i < count; i++) s[i] += (char)('a' + (n + i) % 26);
+	}
+	struct mallinfo2 after = mallinfo2();
+	size_t text = (size_t)count * (length + 1);
+	size_t used = after.uordblks - before.uordblks;
+	size_t gaps = after.fordblks - after.keepcost;
+	printf("%4d Strings of %4d chars: %7zu bytes text, %7zu bytes allocated,"
+		" %7zu bytes in gaps (%.1f%%)\n", count, length, text, used, gaps,
+		100.0 * gaps / (after.uordblks + gaps));
+	delete[] s;
+}
+
+int main(void)
+{
+	printf("sizeof(String) = %zu on this host\n", sizeof(String));
+	bench("String(int)", [](int i) {
+		String s(i);
+		return s.length();
+	});
+	bench("short literal + int", [](int i) {
+		String s = String("id=") + i;
+		return s.length();
+	});
+	bench("sum chain of 6", [](int i) {
+		String s = String("key") + ':' + i + ',' + "value" + ':' + (i * 7);
+		return s.length();
+	});
+	bench("100 x append char", [](int) {
+		String s;
+		for (int n=0; n < 100; n++) s += (char)('a' + n % 26);
+		return s.length();
+	});
+	bench("1000 x append char", [](int) {
+		String s;
+		for (int n=0; n < 1000; n++) s += (char)('a' + n % 26);
+		return s.length();
+	});
+	bench("100 x append int", [](int) {
+		String s;
+		for (int n=0; n < 100; n++) {
+			s += n;
+			s += ',';
+		}
+		return s.length();
+	});
+	mallopt(M_MMAP_THRESHOLD, 1 << 30); // keep everything in the heap
+	fragmentation(16, 100);
+	fragmentation(64, 250);
+	fragmentation(256, 1000);
+	return 0;
+}